@@ -1,12 +1,226 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <sched.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 //////////////////////////////////////////////////////
 //GLOBAL VARIABLE/////////////////////////////////////
 //////////////////////////////////////////////////////
-int SIZE = 256;
+
+//how children are started: fork()+execvp, vfork()+execvp or posix_spawnp
+enum { SPAWN_FORK, SPAWN_VFORK, SPAWN_POSIX, SPAWN_BACKENDS };
+const char* spawnNames[SPAWN_BACKENDS] = { "fork", "vfork", "spawn" };
+int spawnBackend = SPAWN_POSIX;
+
+//the capacity requested for the pipes between pipeline stages
+#define PIPE_SIZE (1 << 20)
+
+//with -c, the output of every job is captured and printed once the job is
+//done, either in the order the jobs finish or in the order they were entered
+enum { CAPTURE_NONE, CAPTURE_DONE, CAPTURE_ORDER };
+int captureMode = CAPTURE_NONE;
+
+//captured output bigger than this moves from memory to a spill file; from
+//then on the pipe is spliced into the file, which is faster than growing
+//the buffer and copying every byte out of the pipe into it
+#define CAPTURE_SPILL (4 << 20)
+
+//the smallest free space a capture buffer is read into
+#define CAPTURE_CHUNK (1 << 16)
+
+//with -k, the page cache of the input files of a job is dropped (or the
+//files are read once) before every benchmark run of the job
+enum { CACHE_KEEP, CACHE_DROP, CACHE_WARM };
+int cacheMode = CACHE_KEEP;
+
+//with -P, every job runs alone on one of the CPUs in pinSet
+int pinCpus = 0;
+cpu_set_t pinSet;
+char cpuBusy[CPU_SETSIZE];
+
+//with -C, commands that succeeded before are replayed from a cache in
+//cacheDir instead of being run again, as long as their argv and the
+//contents of their input files did not change
+const char* cacheDir = NULL;
+long long cacheLimit = 256LL << 20;
+
+//what a cache entry starts with; the identity of the job and then the
+//captured output follow it
+#define CACHE_MAGIC "MASHC02"
+
+extern char** environ;
+
+/////////////////////////////////////////////////////
+//STRUCTURES/////////////////////////////////////////
+/////////////////////////////////////////////////////
+
+/*
+  A command waiting to be, being or done being executed.
+  Fields:
+    argv: the NULL terminated array of strings that make up the command.
+    length: the count returned by parseCmd() for argv.
+    id: the number of the command, in the order it was entered.
+    pid: the pid of the child running the command (0 until launched).
+    status: the wait status of the child once it was reaped.
+    start: the CLOCK_MONOTONIC time the child was spawned at.
+    wallMs: the wall time from spawn to reap, in milliseconds.
+    usage: the resources used by the child, as reported by wait4().
+    in: the fd the child gets as stdin (-1 to inherit mash's).
+    out: the fd the child gets as stdout (-1 to inherit mash's).
+    err: the fd the child gets as stderr (-1 to inherit mash's).
+    pipeFd: with -c, the read end of the pipe the output is captured from.
+    pidFd: with -c, a pidfd that becomes readable when the child exits.
+    output: with -c, the captured output held in memory.
+    outputLen: the number of bytes in output.
+    outputCap: the number of bytes allocated for output.
+    spillFd: with -c, the file the output moved to once it got too big.
+    reaped: set once the child was waited for.
+    emitted: with -c, 1 once the output was printed, -1 while the job is
+             done but waits for the jobs before it to be printed.
+    cpu: with -P, the CPU the job is pinned to (-1 otherwise).
+    warmup: in bench mode, set for the runs that are not measured.
+    key: with -C, the hash of argv and of the contents of the input files.
+    cached: with -C, set when the output was replayed from the cache.
+    cachedMs: with -C, the wall time the job took when it was run and cached.
+*/
+typedef struct
+{
+    char** argv;
+    int length;
+    int id;
+    pid_t pid;
+    int status;
+    struct timespec start;
+    double wallMs;
+    struct rusage usage;
+    int in;
+    int out;
+    int err;
+    int pipeFd;
+    int pidFd;
+    char* output;
+    size_t outputLen;
+    size_t outputCap;
+    int spillFd;
+    int reaped;
+    int emitted;
+    int cpu;
+    int warmup;
+    uint64_t key;
+    int cached;
+    double cachedMs;
+} Job;
+
+/*
+  The header of a cache entry.
+  Fields:
+    magic: CACHE_MAGIC, to tell cache entries from other files.
+    key: the key of the job the entry belongs to.
+    status: the wait status of the job.
+    wallMs: the wall time the job took when it was run.
+    identity: the number of bytes of identity after the header (see
+              cacheIdentity()), compared on a hit so that two jobs whose
+              keys collide never get each other's output.
+    length: the number of bytes of output after the identity.
+*/
+typedef struct
+{
+    char magic[8];
+    uint64_t key;
+    int status;
+    int pad;
+    double wallMs;
+    uint64_t identity;
+    uint64_t length;
+} CacheHeader;
+
+/*
+  How an input file of a job looked when its cache entry was written.
+  Fields:
+    size: the size of the file in bytes.
+    sec: the seconds of its mtime.
+    nsec: the nanoseconds of its mtime.
+*/
+typedef struct
+{
+    int64_t size;
+    int64_t sec;
+    int64_t nsec;
+} CacheInput;
+
+/*
+  A file in the cache directory, while the cache is trimmed.
+  Fields:
+    name: the name of the file.
+    size: the size of the file in bytes.
+    mtime: when the entry was last written or replayed.
+*/
+typedef struct
+{
+    char name[32];
+    long long size;
+    struct timespec mtime;
+} CacheFile;
+
+/*
+  The statistics of one measurement over the runs of a command.
+  Fields:
+    mean: the average.
+    stddev: the sample standard deviation.
+    min: the smallest value.
+    median: the middle value.
+    outliers: how many values are more than 1.5 IQR outside the quartiles.
+*/
+typedef struct
+{
+    double mean;
+    double stddev;
+    double min;
+    double median;
+    int outliers;
+} Stat;
+
+/*
+  The jobs of one mash run. In batch mode the commands are read from the
+  source while the first ones are already running.
+  Fields:
+    jobs: the array of jobs read so far.
+    count: how many jobs are in jobs.
+    capacity: how many jobs fit in jobs before it has to grow.
+    source: where more commands are read from, NULL once it is exhausted.
+    file: the argument added at the end of every command, or NULL.
+    in: the fd every job gets as stdin, -1 to inherit mash's.
+    line: the line buffer used to read source.
+    lineCap: the size of line.
+*/
+typedef struct
+{
+    Job* jobs;
+    int count;
+    int capacity;
+    FILE* source;
+    char* file;
+    int in;
+    char* line;
+    size_t lineCap;
+} JobList;
 
 /////////////////////////////////////////////////////
 //PROTOTYPES/////////////////////////////////////////
@@ -28,13 +242,29 @@ void printLine();
 /**
     Gets the cmd from the user to be executed.
     Parameters:
-     theCmds: the array of strings that contain the commands.
-     whichCmd: the int denoting how many elements are in theCmds.
+     theCmds: set to the command, as built by parseCmd().
+     whichCmd: the number of the command, shown in the prompt.
     Return:
-     an integer that returns the count.
+     an integer that returns the count, or 0 if the line was empty.
 */
 int getCmd(char*** theCmds, int whichCmd);
 
+/**
+    Splits a line into the words of a command. Blanks separate words,
+    'single quotes' keep everything literally, "double quotes" allow
+    backslash escapes of " \\ $ and `, a backslash outside of quotes escapes
+    the next character and a # at the start of a word starts a comment.
+    The array and the strings live in a single allocation, free() it once.
+    Parameters:
+     line: the line to split, it does not need to be NUL terminated.
+     len: the number of characters in line.
+     theCmds: set to the NULL terminated array of words. The second to last
+              slot is left for the file argument (NULL until it is set).
+    Return:
+     the count of slots in theCmds (words + 2), or 0 if there was no word.
+*/
+int parseCmd(const char* line, size_t len, char*** theCmds);
+
 /**
     Executes the commands given by the users.
     Parameters:
@@ -44,20 +274,314 @@ int getCmd(char*** theCmds, int whichCmd);
 void executeCmd(char** theCmds, int whichCmd);
 
 /**
-    Free a double char array.
+    Prints the 80 dashes.
     Parameters:
      theCmds: the array of strings that contain the commands.
      count: the int denoting how many elements are in theCmds.
 */
-void freeDArray(char** theCmds, int count);
+void printDashes(char** theCmds, int count);
 
 /**
-    Prints the 80 dashes.
+    Starts a child executing a command with the given backend. Only the
+    fork backend runs any mash code in the child; vfork and posix_spawn
+    share the parent's address space until the exec.
     Parameters:
-     theCmds: the array of strings that contain the commands.
-     count: the int denoting how many elements are in theCmds.
+     theCmds: the NULL terminated command to execute.
+     whichCmd: the number of the command, used in error messages.
+     backend: one of SPAWN_FORK, SPAWN_VFORK or SPAWN_POSIX.
+     in: the fd to use as the child's stdin, or -1 to inherit it.
+     out: the fd to use as the child's stdout, or -1 to inherit it.
+     err: the fd to use as the child's stderr, or -1 to inherit it.
+    Return:
+     the pid of the child, or -1 (with errno set) if it could not be started.
 */
-void printDashes(char** theCmds, int count);
+pid_t spawnCmd(char** theCmds, int whichCmd, int backend, int in, int out, int err);
+
+/**
+    Fills in a job for a command read by parseCmd().
+    Parameters:
+     theJob: the job to fill in.
+     theCmds: the command, as returned by parseCmd().
+     length: the count returned by parseCmd().
+     id: the number of the command.
+*/
+void initJob(Job* theJob, char** theCmds, int length, int id);
+
+/**
+    Adds a command at the end of a job list.
+    Parameters:
+     theList: the list to add to.
+     theCmds: the command, as returned by parseCmd().
+     length: the count returned by parseCmd().
+*/
+void addJob(JobList* theList, char** theCmds, int length);
+
+/**
+    Returns a job of the list, reading more commands from the source of
+    the list until the job exists.
+    Parameters:
+     theList: the list of jobs.
+     index: the index of the job.
+    Return:
+     the job, or NULL when the source has no more commands.
+*/
+Job* jobAt(JobList* theList, int index);
+
+/**
+    Prints the banner of a job (unless its output is captured) and starts
+    a child executing it.
+    Parameters:
+     theJob: the job to launch, its pid is filled in.
+*/
+void launchJob(Job* theJob);
+
+/**
+    Runs the jobs, keeping at most limit children alive at once. A new job
+    is launched as soon as a running one is reaped.
+    Parameters:
+     theList: the jobs to run.
+     limit: the int denoting how many children may run at the same time.
+*/
+void runJobs(JobList* theList, int limit);
+
+/**
+    Waits for any child and records its status, rusage and wall time in
+    the job it belongs to.
+    Parameters:
+     theJobs: the array of jobs.
+     active: the indexes in theJobs of the jobs whose child is running.
+     running: the int denoting how many indexes are in active.
+    Return:
+     the position in active of the job that finished, or -1 if there was
+     no child left to wait for.
+*/
+int reapJob(Job* theJobs, int* active, int running);
+
+/**
+    Records how a child ended in its job.
+    Parameters:
+     theJob: the job the child belongs to.
+     status: the wait status of the child.
+     usage: the resources used by the child.
+*/
+void finishJob(Job* theJob, int status, struct rusage* usage);
+
+/**
+    Runs the jobs like runJobs(), but sends the stdout and stderr of every
+    child into its own pipe. An epoll loop drains the pipes into per job
+    buffers (or spill files) and reaps the children through pidfds. The
+    output of each job is printed in one piece once the job is done.
+    Parameters:
+     theList: the jobs to run.
+     limit: the int denoting how many children may run at the same time.
+*/
+void runCaptured(JobList* theList, int limit);
+
+/**
+    Reads everything currently available from the capture pipe of a job.
+    Parameters:
+     theJob: the job to read the output of.
+    Return:
+     1 once the pipe reached end of file, 0 otherwise.
+*/
+int drainJob(Job* theJob);
+
+/**
+    Prints the banner, the captured output and the timing of a job.
+    Parameters:
+     theJob: the job to print.
+*/
+void emitJob(Job* theJob);
+
+/**
+    Runs the jobs as one pipeline: the stdout of each command is connected
+    to the stdin of the next one. Every stage runs at the same time.
+    Parameters:
+     theJobs: the array of jobs making up the pipeline, in order.
+     count: the int denoting how many jobs are in theJobs.
+     outFile: the file the output of the last stage is captured into,
+              or NULL to let the last stage write to mash's stdout.
+     teeOut: if set, the captured output is also copied to mash's stdout.
+*/
+void runPipeline(Job* theJobs, int count, const char* outFile, int teeOut);
+
+/**
+    Moves everything from a pipe into a file until the pipe is closed,
+    with splice() so the data never goes through a user space buffer.
+    When teeOut is set the data is also duplicated to stdout with tee().
+    Parameters:
+     from: the read end of the pipe.
+     to: the fd of the file.
+     teeOut: if set, the data is also written to stdout.
+    Return:
+     0 on success, -1 on error.
+*/
+int pumpPipe(int from, int to, int teeOut);
+
+/**
+    Moves exactly len bytes from a pipe to an fd, with splice() when the
+    fd supports it and with read()/write() otherwise.
+    Parameters:
+     from: the read end of the pipe.
+     to: the fd to write to.
+     len: the number of bytes to move.
+    Return:
+     1 when len bytes were moved, 0 when the pipe was closed before (what
+     came until then was moved), -1 on error with errno set.
+*/
+int moveBytes(int from, int to, size_t len);
+
+/**
+    Returns the milliseconds elapsed between two CLOCK_MONOTONIC times.
+    Parameters:
+     from: the earlier time.
+     to: the later time.
+*/
+double elapsedMs(struct timespec* from, struct timespec* to);
+
+/**
+    Returns a timeval (as used by struct rusage) in milliseconds.
+    Parameters:
+     tv: the time to convert.
+*/
+double timevalMs(struct timeval* tv);
+
+/**
+    Prints the timing and resources of every job as a table.
+    Parameters:
+     theJobs: the array of jobs that were run.
+     count: the int denoting how many jobs are in theJobs.
+*/
+void printReport(Job* theJobs, int count);
+
+/**
+    Writes the timing and resources of every job as a JSON array.
+    Parameters:
+     theJobs: the array of jobs that were run.
+     count: the int denoting how many jobs are in theJobs.
+     out: the file the JSON goes to, apart from the prompts and the output
+          of the commands on stdout.
+*/
+void printJsonReport(Job* theJobs, int count, FILE* out);
+
+/**
+    Measures how many /bin/true children per second each spawn backend
+    can start and reap.
+    Parameters:
+     count: the int denoting how many children to spawn per backend.
+     ballastMb: the int denoting how many MB the parent should touch first,
+                to show how the cost of fork() grows with the parent.
+*/
+void benchSpawn(int count, int ballastMb);
+
+/**
+    Tells if a command argument names a regular file the command may read.
+    Parameters:
+     arg: the argument.
+    Return:
+     1 if it is a regular file, 0 otherwise.
+*/
+int isInputFile(const char* arg);
+
+/**
+    Drops the input files of a job from the page cache, or reads them into
+    it, depending on cacheMode.
+    Parameters:
+     theJob: the job about to be run.
+*/
+void prepareCaches(Job* theJob);
+
+/**
+    Makes mash itself run on a free CPU of pinSet, so that the next child
+    inherits that CPU, and records the CPU in the job.
+    Parameters:
+     theJob: the job about to be run.
+*/
+void pinJob(Job* theJob);
+
+/**
+    Runs every command warmups + runs times and prints the statistics of
+    the measured runs, with the relative speed of the commands.
+    Parameters:
+     theList: the commands to benchmark.
+     limit: the int denoting how many children may run at the same time;
+            above 1 the runs slow each other down and skew the statistics.
+     runs: the int denoting how many measured runs each command gets.
+     warmups: the int denoting how many unmeasured runs come first.
+     json: if not NULL, the runs are written to it as JSON as well.
+*/
+void runBench(JobList* theList, int limit, int runs, int warmups, FILE* json);
+
+/**
+    Computes the statistics of a set of values.
+    Parameters:
+     values: the values, they are sorted in place.
+     count: the int denoting how many values there are.
+     stat: filled in with the statistics.
+*/
+void computeStat(double* values, int count, Stat* stat);
+
+/**
+    Orders two doubles for qsort().
+    Parameters:
+     a: the first double.
+     b: the second double.
+*/
+int compareDoubles(const void* a, const void* b);
+
+/**
+    Hashes the argv of a job and the contents of the arguments that are
+    regular files, with 64 bit FNV-1a.
+    Parameters:
+     theJob: the job to compute the cache key of.
+    Return:
+     the key.
+*/
+uint64_t cacheKey(Job* theJob);
+
+/**
+    Describes a job beyond its key: its argv, every string with its NUL,
+    then a CacheInput for every argument that is a regular file.
+    Parameters:
+     theJob: the job to describe.
+     length: set to the number of bytes of the description.
+    Return:
+     the description, to be freed by the caller.
+*/
+char* cacheIdentity(Job* theJob, size_t* length);
+
+/**
+    Replays a job from the cache when there is an entry for its key, and
+    marks the entry as recently used.
+    Parameters:
+     theJob: the job about to be run, with its key set.
+    Return:
+     1 if the job was replayed (it is then reaped with its output captured),
+     0 if it has to be run.
+*/
+int loadCache(Job* theJob);
+
+/**
+    Stores the captured output of a job that exited with 0 in the cache,
+    from memory or from its spill file.
+    Parameters:
+     theJob: the job that is done.
+*/
+void storeCache(Job* theJob);
+
+/**
+    Removes the least recently used cache entries until the cache is no
+    bigger than cacheLimit.
+*/
+void trimCache();
+
+/**
+    Orders cache files from the least to the most recently used for qsort().
+    Parameters:
+     a: the first CacheFile.
+     b: the second CacheFile.
+*/
+int compareCacheFiles(const void* a, const void* b);
 
 /////////////////////////////////////////////////////
 //Methods////////////////////////////////////////////
@@ -87,35 +611,97 @@ void printLine()
 
 int getCmd(char*** theCmds, int whichCmd)
 {
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
     int count;
-    int end;
-    char temp;
 
-    (*theCmds)[0] = (char*) calloc(SIZE, sizeof(char));
     printf("mash-%d>", whichCmd);
-    scanf("%s", (*theCmds)[0]);
+    fflush(stdout);
+
+    //an empty line (or the end of input) ends the list of commands
+    len = getline(&line, &cap, stdin);
+    count = len > 0 ? parseCmd(line, len, theCmds) : 0;
+
+    free(line);
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////
 
-    count = 1;
-    end = scanf ("%c", &temp);
+int parseCmd(const char* line, size_t len, char*** theCmds)
+{
+    const char* p = line;
+    const char* end = line + len;
+    size_t maxWords = len / 2 + 1;
+    char** words;
+    char* out;
+    int count = 0;
+
+    //every word but the last is followed by a blank, so there are at most
+    //len / 2 + 1 words and the words with their NULs fit in len + 1 bytes
+    words = (char**) malloc((maxWords + 2) * sizeof(char*) + len + 1);
+    out = (char*) (words + maxWords + 2);
+
+    while(1)
+    {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        {
+            p++;
+        }
+        if(p == end || *p == '#')
+        {
+            break;
+        }
 
-    while(temp != '\n' && end == 1)
-    {    
-        
-        *theCmds = (char**) realloc(*theCmds, (++count) * sizeof(char*));
-        
-        (*theCmds)[count - 1] = (char*) calloc(SIZE, sizeof(char));
-        scanf("%s", (*theCmds)[count - 1]);
-        end = scanf ("%c", &temp);
+        words[count++] = out;
+        while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        {
+            if(*p == '\'')
+            {
+                for(p++; p < end && *p != '\''; p++)
+                {
+                    *out++ = *p;
+                }
+                p += (p < end);
+            }
+            else if(*p == '"')
+            {
+                for(p++; p < end && *p != '"'; p++)
+                {
+                    if(*p == '\\' && p + 1 < end && strchr("\"\\$`", p[1]) != NULL)
+                    {
+                        p++;
+                    }
+                    *out++ = *p;
+                }
+                p += (p < end);
+            }
+            else if(*p == '\\' && p + 1 < end)
+            {
+                *out++ = p[1];
+                p += 2;
+            }
+            else
+            {
+                *out++ = *p++;
+            }
+        }
+        *out++ = '\0';
     }
 
-    *theCmds = realloc(*theCmds, (++count) * sizeof(char*));
-    (*theCmds)[count - 1] = calloc(SIZE, sizeof(char));
-    *theCmds = realloc(*theCmds, (++count) * sizeof(char*));
+    if(count == 0)
+    {
+        free(words);
+        return 0;
+    }
 
-    //the file
-    (*theCmds)[count - 1] = "\0";
+    //the file, then the end of the command
+    words[count] = NULL;
+    words[count + 1] = NULL;
 
-    return count;
+    *theCmds = words;
+    return count + 2;
 }
 
 /////////////////////////////////////////////////////////////////
@@ -132,16 +718,6 @@ void executeCmd(char** theCmds, int whichCmd)
 
 /////////////////////////////////////////////////////////////////
 
-void freeDArray(char** theCmds, int length)
-{
-    int i;
-    for(i = 0; i < length; i++)
-    {
-        free(theCmds[i]);
-    }
-    free(theCmds);
-}
-
 void printDashes(char** theCmds, int count)
 {
     int dashes = 62, i;
@@ -158,126 +734,1739 @@ void printDashes(char** theCmds, int count)
     printf("\n");
 }
 
-///////////////////////////////////////////////////////////
-/////////////////////MAIN//////////////////////////////////
-///////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////
 
-int main()
+pid_t spawnCmd(char** theCmds, int whichCmd, int backend, int in, int out, int err)
 {
-    int status = 1, mainLoopN = 3;
-
-    pid_t pidf;
-    int length1;
-    char** theScript1 = (char**) malloc(sizeof(char*)); 
-    length1 = getCmd(&theScript1, 1);
-    //printf("%d\n", length1);
-    //printf("%s\n", theScript1[length1 - 1]);
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int error;
 
-    pid_t pids;
-    int length2;
-    char** theScript2 = (char**) malloc(sizeof(char*));
-    length2 = getCmd(&theScript2, 2);
-
-    pid_t pidt;
-    int length3;
-    char** theScript3 = (char**) malloc(sizeof(char*));
-    length3 = getCmd(&theScript3, 3);
-
-    char file[250] = "file";
-    int* fp = &file;
+    switch(backend)
+    {
+        case SPAWN_FORK:
+            pid = fork();
+            if(pid == 0)
+            {
+                if((in >= 0 && dup2(in, STDIN_FILENO) < 0) ||
+                   (out >= 0 && dup2(out, STDOUT_FILENO) < 0) ||
+                   (err >= 0 && dup2(err, STDERR_FILENO) < 0))
+                {
+                    _exit(127);
+                }
+                executeCmd(theCmds, whichCmd);
+                fflush(stdout);
+                _exit(127);
+            }
+            return pid;
 
-    printf("file>");
-    scanf("%s", file);
+        case SPAWN_VFORK:
+            //the child borrows our memory until execvp, so it may only exec or _exit
+            pid = vfork();
+            if(pid == 0)
+            {
+                if((in >= 0 && dup2(in, STDIN_FILENO) < 0) ||
+                   (out >= 0 && dup2(out, STDOUT_FILENO) < 0) ||
+                   (err >= 0 && dup2(err, STDERR_FILENO) < 0))
+                {
+                    _exit(127);
+                }
+                execvp(*theCmds, theCmds);
+                _exit(127);
+            }
+            return pid;
 
-    theScript1[length1 - 2] = fp;
-    theScript2[length2 - 2] = fp;
-    theScript3[length3 - 2] = fp;
+        default:
+            posix_spawn_file_actions_init(&actions);
+            if(in >= 0)
+            {
+                posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+            }
+            if(out >= 0)
+            {
+                posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+            }
+            if(err >= 0)
+            {
+                posix_spawn_file_actions_adddup2(&actions, err, STDERR_FILENO);
+            }
+            error = posix_spawnp(&pid, *theCmds, &actions, NULL, theCmds, environ);
+            posix_spawn_file_actions_destroy(&actions);
+            if(error != 0)
+            {
+                errno = error;
+                return -1;
+            }
+            return pid;
+    }
+}
 
-    strncpy(theScript2[length2 - 2], theScript1[length1 - 2], strlen(theScript1[length1 - 2]));
-    theScript2[length2 - 1] = NULL;
-    strncpy(theScript3[length3 - 2], theScript1[length1 - 2], strlen(theScript1[length1 - 2]));
-    theScript3[length3 - 1] = NULL;
+/////////////////////////////////////////////////////////////////
 
-    pidf = fork();
+void initJob(Job* theJob, char** theCmds, int length, int id)
+{
+    memset(theJob, 0, sizeof(Job));
+    theJob->argv = theCmds;
+    theJob->length = length;
+    theJob->id = id;
+    theJob->in = -1;
+    theJob->out = -1;
+    theJob->err = -1;
+    theJob->pipeFd = -1;
+    theJob->pidFd = -1;
+    theJob->spillFd = -1;
+    theJob->cpu = -1;
+}
 
-    int t;
-    time_t start, end;
+/////////////////////////////////////////////////////////////////
 
-    if(pidf == 0)
+void addJob(JobList* theList, char** theCmds, int length)
+{
+    if(theList->count == theList->capacity)
     {
-        printf("-----LAUNCH CMD 1:"); //18
-        printCmd(theScript1, length1);
-        printDashes(theScript1, length1);
-            
-        start = clock();
-
-        executeCmd(theScript1, 1);
-        
-        end = clock();
-        t = (end - start);
-
-        printf("Result took: %dms\n", t);
-        printLine();
-
-        abort();
+        theList->capacity = theList->capacity ? theList->capacity * 2 : 8;
+        theList->jobs = (Job*) realloc(theList->jobs, theList->capacity * sizeof(Job));
     }
-    else
-    {
-        pids = fork();
-        if(pids == 0)
-        {
-            printf("-----LAUNCH CMD 2:");
-            printCmd(theScript2, length2);
-            printDashes(theScript2, length2);
-            
-            start = clock();
 
-            executeCmd(theScript2, 2);
-            
-            end = clock();
-            t = (end - start);
+    theCmds[length - 2] = theList->file;
+    initJob(&theList->jobs[theList->count], theCmds, length, theList->count + 1);
+    theList->jobs[theList->count].in = theList->in;
+    theList->count++;
+}
 
-            printf("Result took: %dms\n", t);
-            printLine();
+/////////////////////////////////////////////////////////////////
 
-            abort();
-        }
-        else
+Job* jobAt(JobList* theList, int index)
+{
+    char** theCmds;
+    ssize_t len;
+    int length;
+
+    while(index >= theList->count && theList->source != NULL)
+    {
+        len = getline(&theList->line, &theList->lineCap, theList->source);
+        if(len < 0)
         {
-            pidt = fork();
-            if(pidt == 0) 
+            if(theList->source != stdin)
             {
-                printf("-----LAUNCH CMD 3:");
-                printCmd(theScript3, length3);
-                printDashes(theScript3, length3);    
-                
-                start = clock();
-
-                executeCmd(theScript3, 3);
-                
-                end = clock();
-                t = (end - start);
-
-                printf("Result took: %dms\n", t);
-                printLine();
-
-                abort();
+                fclose(theList->source);
             }
+            theList->source = NULL;
+            break;
         }
 
-        while (mainLoopN > 0)
+        //blank lines and comments are skipped
+        length = parseCmd(theList->line, len, &theCmds);
+        if(length > 0)
         {
-            wait(&status);
-            mainLoopN--;  
+            addJob(theList, theCmds, length);
         }
-
-        printLine();
-        printf("Done waiting on children: %d %d %d\n", pidf, pids, pidt);
-        
-        freeDArray(theScript1, length1 - 2);
-        freeDArray(theScript2, length2 - 2);
-        freeDArray(theScript3, length3 - 2);
     }
-    
+
+    return index < theList->count ? &theList->jobs[index] : NULL;
+}
+
+/////////////////////////////////////////////////////////////////
+
+void launchJob(Job* theJob)
+{
+    if(captureMode == CAPTURE_NONE)
+    {
+        printf("-----LAUNCH CMD %d:", theJob->id);
+        printCmd(theJob->argv, theJob->length);
+        printDashes(theJob->argv, theJob->length);
+        fflush(stdout);
+    }
+
+    if(cacheMode != CACHE_KEEP)
+    {
+        prepareCaches(theJob);
+    }
+    if(pinCpus)
+    {
+        pinJob(theJob);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &theJob->start);
+    theJob->pid = spawnCmd(theJob->argv, theJob->id, spawnBackend, theJob->in, theJob->out,
+                           theJob->err);
+
+    if(pinCpus)
+    {
+        sched_setaffinity(0, sizeof(cpu_set_t), &pinSet);
+    }
+
+    if(theJob->pid < 0)
+    {
+        printf("[SHELL %d] STATUS CODE == -1 (%s)\n", theJob->id, strerror(errno));
+        theJob->status = 127 << 8;
+        theJob->reaped = 1;
+        if(theJob->cpu >= 0)
+        {
+            cpuBusy[theJob->cpu] = 0;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void runJobs(JobList* theList, int limit)
+{
+    int next = 0, running = 0, i;
+    int* active = (int*) malloc(limit * sizeof(int));
+    Job* job;
+
+    while(1)
+    {
+        //start jobs until every slot is taken
+        while(running < limit && (job = jobAt(theList, next)) != NULL)
+        {
+            launchJob(job);
+            if(job->pid > 0)
+            {
+                active[running++] = next;
+            }
+            next++;
+        }
+
+        if(running == 0)
+        {
+            break;
+        }
+
+        //reap whichever child finishes first to free its slot
+        i = reapJob(theList->jobs, active, running);
+        if(i < 0)
+        {
+            break;
+        }
+        active[i] = active[--running];
+    }
+
+    free(active);
+}
+
+/////////////////////////////////////////////////////////////////
+
+int reapJob(Job* theJobs, int* active, int running)
+{
+    int status, i;
+    struct rusage usage;
+    pid_t pid;
+
+    while(1)
+    {
+        pid = wait4(-1, &status, 0, &usage);
+        if(pid < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            printf("[SHELL] wait4 failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        for(i = 0; i < running; i++)
+        {
+            if(theJobs[active[i]].pid == pid)
+            {
+                finishJob(&theJobs[active[i]], status, &usage);
+                return i;
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void finishJob(Job* theJob, int status, struct rusage* usage)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    theJob->status = status;
+    theJob->usage = *usage;
+    theJob->wallMs = elapsedMs(&theJob->start, &end);
+    theJob->reaped = 1;
+
+    if(theJob->cpu >= 0)
+    {
+        cpuBusy[theJob->cpu] = 0;
+    }
+
+    if(captureMode == CAPTURE_NONE)
+    {
+        printf("[SHELL %d] Result took: %.3fms\n", theJob->id, theJob->wallMs);
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void runCaptured(JobList* theList, int limit)
+{
+    struct epoll_event ev, events[64];
+    int epfd, next = 0, running = 0, emitted = 0, timeout = -1, fds[2], n, i, status;
+    struct rusage usage;
+    int* active;
+    Job* job;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0)
+    {
+        printf("[SHELL] epoll_create1 failed: %s\n", strerror(errno));
+        return;
+    }
+    active = (int*) malloc(limit * sizeof(int));
+
+    while(1)
+    {
+        //start jobs until every slot is taken
+        while(running < limit && (job = jobAt(theList, next)) != NULL)
+        {
+            next++;
+            if(cacheDir != NULL)
+            {
+                job->key = cacheKey(job);
+                if(loadCache(job))
+                {
+                    //replayed jobs never take a slot
+                    if(captureMode == CAPTURE_DONE)
+                    {
+                        emitJob(job);
+                        emitted++;
+                    }
+                    else
+                    {
+                        job->emitted = -1;
+                    }
+                    continue;
+                }
+            }
+            active[running++] = next - 1;
+
+            if(pipe2(fds, O_CLOEXEC) < 0)
+            {
+                printf("[SHELL %d] pipe failed: %s\n", job->id, strerror(errno));
+                job->status = 127 << 8;
+                job->pid = -1;
+                job->reaped = 1;
+                continue;
+            }
+            fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+            fcntl(fds[0], F_SETFL, O_NONBLOCK);
+            job->out = job->err = fds[1];
+
+            launchJob(job);
+            close(fds[1]);
+            job->out = job->err = -1;
+            job->pipeFd = fds[0];
+
+            //the low bit of the event data tells the pipe and the pidfd apart
+            ev.events = EPOLLIN;
+            ev.data.u64 = (uint64_t) (job - theList->jobs) << 1;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, job->pipeFd, &ev);
+
+            if(job->pid > 0)
+            {
+#ifdef SYS_pidfd_open
+                job->pidFd = (int) syscall(SYS_pidfd_open, job->pid, 0);
+#endif
+                if(job->pidFd >= 0)
+                {
+                    ev.data.u64 |= 1;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, job->pidFd, &ev);
+                }
+                else
+                {
+                    //no pidfd (old kernel): poll for the exit instead
+                    timeout = 10;
+                }
+            }
+        }
+
+        //in submission order a job waits until everything before it was printed
+        while(captureMode == CAPTURE_ORDER && emitted < next &&
+              theList->jobs[emitted].emitted == -1)
+        {
+            emitJob(&theList->jobs[emitted++]);
+        }
+
+        if(running == 0)
+        {
+            break;
+        }
+
+        n = epoll_wait(epfd, events, 64, timeout);
+        if(n < 0 && errno != EINTR)
+        {
+            printf("[SHELL] epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for(i = 0; i < n; i++)
+        {
+            job = &theList->jobs[events[i].data.u64 >> 1];
+
+            if(events[i].data.u64 & 1)
+            {
+                if(wait4(job->pid, &status, WNOHANG, &usage) == job->pid)
+                {
+                    finishJob(job, status, &usage);
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, job->pidFd, NULL);
+                    close(job->pidFd);
+                    job->pidFd = -1;
+                }
+            }
+            else if(drainJob(job))
+            {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, job->pipeFd, NULL);
+                close(job->pipeFd);
+                job->pipeFd = -1;
+            }
+        }
+
+        //a job is done once its child exited and its pipe was drained
+        for(i = 0; i < running; )
+        {
+            job = &theList->jobs[active[i]];
+            if(!job->reaped && job->pidFd < 0 &&
+               wait4(job->pid, &status, WNOHANG, &usage) == job->pid)
+            {
+                finishJob(job, status, &usage);
+            }
+
+            if(job->reaped && job->pipeFd < 0)
+            {
+                active[i] = active[--running];
+                if(cacheDir != NULL)
+                {
+                    storeCache(job);
+                }
+                if(captureMode == CAPTURE_DONE)
+                {
+                    emitJob(job);
+                    emitted++;
+                }
+                else
+                {
+                    job->emitted = -1;
+                }
+                continue;
+            }
+            i++;
+        }
+    }
+
+    free(active);
+    close(epfd);
+}
+
+/////////////////////////////////////////////////////////////////
+
+int drainJob(Job* theJob)
+{
+    char name[] = "/tmp/mash-capture-XXXXXX";
+    char* grown;
+    ssize_t n;
+    size_t want;
+
+    while(1)
+    {
+        if(theJob->spillFd >= 0)
+        {
+            //spilled output goes straight from the pipe into the file
+            n = splice(theJob->pipeFd, NULL, theJob->spillFd, NULL, PIPE_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+        else
+        {
+            if(theJob->outputCap - theJob->outputLen < CAPTURE_CHUNK)
+            {
+                want = theJob->outputCap ? theJob->outputCap * 2 : CAPTURE_CHUNK * 4;
+                grown = want > CAPTURE_SPILL ? NULL : (char*) realloc(theJob->output, want);
+
+                //too much to hold, or no memory to hold it: the rest goes to a file
+                if(grown == NULL)
+                {
+                    theJob->spillFd = mkstemp(name);
+                    if(theJob->spillFd >= 0)
+                    {
+                        unlink(name);
+                        if(write(theJob->spillFd, theJob->output, theJob->outputLen) !=
+                           (ssize_t) theJob->outputLen)
+                        {
+                            printf("[SHELL %d] spill failed: %s\n", theJob->id, strerror(errno));
+                        }
+                        free(theJob->output);
+                        theJob->output = NULL;
+                        theJob->outputLen = theJob->outputCap = 0;
+                        continue;
+                    }
+                    if(want > CAPTURE_SPILL)
+                    {
+                        grown = (char*) realloc(theJob->output, want);
+                    }
+                    if(grown == NULL && theJob->outputCap == theJob->outputLen)
+                    {
+                        //nowhere to put the output: closing the pipe ends the job
+                        printf("[SHELL %d] capture failed: %s\n", theJob->id, strerror(errno));
+                        return 1;
+                    }
+                }
+                if(grown != NULL)
+                {
+                    theJob->output = grown;
+                    theJob->outputCap = want;
+                }
+            }
+            n = read(theJob->pipeFd, theJob->output + theJob->outputLen,
+                     theJob->outputCap - theJob->outputLen);
+            if(n > 0)
+            {
+                theJob->outputLen += n;
+            }
+        }
+
+        if(n == 0)
+        {
+            return 1;
+        }
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return errno != EAGAIN;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void emitJob(Job* theJob)
+{
+    char buffer[65536];
+    off_t offset = 0;
+    ssize_t n;
+    size_t off;
+
+    printf("-----LAUNCH CMD %d:", theJob->id);
+    printCmd(theJob->argv, theJob->length);
+    printDashes(theJob->argv, theJob->length);
+    fflush(stdout);
+
+    for(off = 0; off < theJob->outputLen; off += n)
+    {
+        n = write(STDOUT_FILENO, theJob->output + off, theJob->outputLen - off);
+        if(n < 0)
+        {
+            break;
+        }
+    }
+
+    if(theJob->spillFd >= 0)
+    {
+        while((n = sendfile(STDOUT_FILENO, theJob->spillFd, &offset, PIPE_SIZE)) > 0);
+        if(n < 0)
+        {
+            //stdout cannot be sent to, copy the rest by hand
+            lseek(theJob->spillFd, offset, SEEK_SET);
+            while((n = read(theJob->spillFd, buffer, sizeof(buffer))) > 0 &&
+                  write(STDOUT_FILENO, buffer, n) == n);
+        }
+        close(theJob->spillFd);
+        theJob->spillFd = -1;
+    }
+
+    if(theJob->cached)
+    {
+        printf("[SHELL %d] Result took: %.3fms originally (from cache, replayed in %.3fms)\n",
+               theJob->id, theJob->cachedMs, theJob->wallMs);
+    }
+    else
+    {
+        printf("[SHELL %d] Result took: %.3fms\n", theJob->id, theJob->wallMs);
+    }
+    printLine();
+    fflush(stdout);
+
+    free(theJob->output);
+    theJob->output = NULL;
+    theJob->emitted = 1;
+}
+
+/////////////////////////////////////////////////////////////////
+
+void runPipeline(Job* theJobs, int count, const char* outFile, int teeOut)
+{
+    int fds[2], prevRead = -1, capture = -1, fileFd = -1, running = 0, i;
+    int* active;
+
+    if(outFile != NULL)
+    {
+        fileFd = open(outFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fileFd < 0)
+        {
+            printf("[SHELL] cannot open %s: %s\n", outFile, strerror(errno));
+            return;
+        }
+    }
+    active = (int*) malloc(count * sizeof(int));
+
+    for(i = 0; i < count; i++)
+    {
+        theJobs[i].in = prevRead;
+        theJobs[i].out = -1;
+
+        //every stage but the last writes into a pipe, and so does the last
+        //one when mash captures the output
+        if(i < count - 1 || fileFd >= 0)
+        {
+            if(pipe2(fds, O_CLOEXEC) < 0)
+            {
+                printf("[SHELL] pipe failed: %s\n", strerror(errno));
+                break;
+            }
+            fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+            theJobs[i].out = fds[1];
+        }
+
+        launchJob(&theJobs[i]);
+        if(theJobs[i].pid > 0)
+        {
+            active[running++] = i;
+        }
+
+        //the children own these ends now
+        if(prevRead >= 0)
+        {
+            close(prevRead);
+        }
+        if(theJobs[i].out >= 0)
+        {
+            close(theJobs[i].out);
+            prevRead = fds[0];
+        }
+    }
+
+    if(fileFd >= 0 && i == count)
+    {
+        capture = prevRead;
+        if(pumpPipe(capture, fileFd, teeOut) < 0)
+        {
+            printf("[SHELL] capturing into %s failed: %s\n", outFile, strerror(errno));
+        }
+    }
+    if(prevRead >= 0)
+    {
+        close(prevRead);
+    }
+    if(fileFd >= 0)
+    {
+        close(fileFd);
+    }
+
+    while(running > 0 && (i = reapJob(theJobs, active, running)) >= 0)
+    {
+        active[i] = active[--running];
+    }
+    free(active);
+}
+
+/////////////////////////////////////////////////////////////////
+
+int pumpPipe(int from, int to, int teeOut)
+{
+    int dup[2];
+    ssize_t n;
+
+    if(!teeOut)
+    {
+        while((n = splice(from, NULL, to, NULL, PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE)) != 0)
+        {
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                if(errno == EINVAL)
+                {
+                    //the file does not support splice, copy until the end
+                    while((n = moveBytes(from, to, PIPE_SIZE)) > 0);
+                    return n < 0 ? -1 : 0;
+                }
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if(pipe2(dup, O_CLOEXEC) < 0)
+    {
+        return -1;
+    }
+    fcntl(dup[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    //tee() copies page references into the second pipe without consuming
+    //them, then both pipes are spliced to their destinations
+    while((n = tee(from, dup[1], PIPE_SIZE, 0)) != 0)
+    {
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        //the n bytes are in both pipes already, an early end is an error too
+        if(moveBytes(from, to, n) <= 0 || moveBytes(dup[0], STDOUT_FILENO, n) <= 0)
+        {
+            n = -1;
+            break;
+        }
+    }
+
+    close(dup[0]);
+    close(dup[1]);
+    return n < 0 ? -1 : 0;
+}
+
+/////////////////////////////////////////////////////////////////
+
+int moveBytes(int from, int to, size_t len)
+{
+    char buffer[65536];
+    ssize_t n, w, off;
+
+    while(len > 0)
+    {
+        n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(n < 0 && errno == EINVAL)
+        {
+            //not every fd (e.g. a terminal) can be spliced to
+            n = read(from, buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+            for(off = 0; n > 0 && off < n; off += w)
+            {
+                w = write(to, buffer + off, n - off);
+                if(w < 0)
+                {
+                    return -1;
+                }
+            }
+        }
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if(n == 0)
+        {
+            return 0;
+        }
+        len -= n;
+    }
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////
+
+double elapsedMs(struct timespec* from, struct timespec* to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+/////////////////////////////////////////////////////////////////
+
+double timevalMs(struct timeval* tv)
+{
+    return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+/////////////////////////////////////////////////////////////////
+
+void printReport(Job* theJobs, int count)
+{
+    int i;
+    char exitStr[16];
+
+    printf("%4s %11s %10s %10s %10s %8s %8s %8s %8s %6s  %s\n", "CMD", "WALL(ms)", "USER(ms)",
+           "SYS(ms)", "MAXRSS(kB)", "VCSW", "IVCSW", "MINFLT", "MAJFLT", "EXIT", "COMMAND");
+
+    for(i = 0; i < count; i++)
+    {
+        Job* job = &theJobs[i];
+        if(!job->reaped)
+        {
+            snprintf(exitStr, sizeof(exitStr), "-");
+        }
+        else if(WIFSIGNALED(job->status))
+        {
+            snprintf(exitStr, sizeof(exitStr), "sig%d", WTERMSIG(job->status));
+        }
+        else
+        {
+            snprintf(exitStr, sizeof(exitStr), "%d", WEXITSTATUS(job->status));
+        }
+
+        printf("%4d %11.3f %10.3f %10.3f %10ld %8ld %8ld %8ld %8ld %6s  ", job->id, job->wallMs,
+               timevalMs(&job->usage.ru_utime), timevalMs(&job->usage.ru_stime),
+               job->usage.ru_maxrss, job->usage.ru_nvcsw, job->usage.ru_nivcsw,
+               job->usage.ru_minflt, job->usage.ru_majflt, exitStr);
+        printCmd(job->argv, job->length);
+        printf("\n");
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void printJsonReport(Job* theJobs, int count, FILE* out)
+{
+    int i, j;
+    const char* c;
+
+    fprintf(out, "[\n");
+    for(i = 0; i < count; i++)
+    {
+        Job* job = &theJobs[i];
+
+        fprintf(out, "  {\"id\": %d, \"argv\": [", job->id);
+        for(j = 0; job->argv[j] != NULL; j++)
+        {
+            fprintf(out, "%s\"", j ? ", " : "");
+            for(c = job->argv[j]; *c; c++)
+            {
+                if(*c == '"' || *c == '\\')
+                {
+                    fprintf(out, "\\%c", *c);
+                }
+                else if((unsigned char) *c < 0x20)
+                {
+                    fprintf(out, "\\u%04x", *c);
+                }
+                else
+                {
+                    fputc(*c, out);
+                }
+            }
+            fprintf(out, "\"");
+        }
+        fprintf(out, "], ");
+
+        if(job->reaped && WIFSIGNALED(job->status))
+        {
+            fprintf(out, "\"exit\": null, \"signal\": %d, ", WTERMSIG(job->status));
+        }
+        else if(job->reaped)
+        {
+            fprintf(out, "\"exit\": %d, \"signal\": null, ", WEXITSTATUS(job->status));
+        }
+        else
+        {
+            fprintf(out, "\"exit\": null, \"signal\": null, ");
+        }
+
+        fprintf(out, "\"wall_ms\": %.3f, \"user_ms\": %.3f, \"sys_ms\": %.3f, \"maxrss_kb\": %ld, "
+                "\"vcsw\": %ld, \"ivcsw\": %ld, \"minflt\": %ld, \"majflt\": %ld}%s\n",
+                job->wallMs, timevalMs(&job->usage.ru_utime), timevalMs(&job->usage.ru_stime),
+                job->usage.ru_maxrss, job->usage.ru_nvcsw, job->usage.ru_nivcsw,
+                job->usage.ru_minflt, job->usage.ru_majflt, i < count - 1 ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
+
+/////////////////////////////////////////////////////////////////
+
+void benchSpawn(int count, int ballastMb)
+{
+    char* trueCmd[] = { "/bin/true", NULL };
+    char* ballast = NULL;
+    struct timespec start, end;
+    int backend, i, status;
+    double ms;
+    pid_t pid;
+
+    if(ballastMb > 0)
+    {
+        ballast = (char*) malloc((size_t) ballastMb << 20);
+        if(ballast != NULL)
+        {
+            memset(ballast, 1, (size_t) ballastMb << 20);
+        }
+    }
+
+    printf("spawning %d x /bin/true per backend, parent ballast %dMB\n", count, ballastMb);
+    for(backend = 0; backend < SPAWN_BACKENDS; backend++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i = 0; i < count; i++)
+        {
+            pid = spawnCmd(trueCmd, 0, backend, -1, -1, -1);
+            if(pid < 0)
+            {
+                printf("[SHELL] %s failed: %s\n", spawnNames[backend], strerror(errno));
+                break;
+            }
+            waitpid(pid, &status, 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        ms = elapsedMs(&start, &end);
+        printf("%-6s %8d spawns %10.3fms %10.1f spawns/sec %8.2fus/spawn\n", spawnNames[backend],
+               i, ms, i / (ms / 1000.0), i ? ms * 1000.0 / i : 0.0);
+    }
+
+    free(ballast);
+}
+
+/////////////////////////////////////////////////////////////////
+
+int isInputFile(const char* arg)
+{
+    struct stat st;
+
+    return arg != NULL && stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void prepareCaches(Job* theJob)
+{
+    char buffer[65536];
+    int i, fd;
+
+    for(i = 1; theJob->argv[i] != NULL; i++)
+    {
+        if(!isInputFile(theJob->argv[i]) ||
+           (fd = open(theJob->argv[i], O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            continue;
+        }
+
+        if(cacheMode == CACHE_DROP)
+        {
+            //only clean pages can be dropped
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        else
+        {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            while(read(fd, buffer, sizeof(buffer)) > 0);
+        }
+        close(fd);
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void pinJob(Job* theJob)
+{
+    cpu_set_t one;
+    int cpu;
+
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(CPU_ISSET(cpu, &pinSet) && !cpuBusy[cpu])
+        {
+            cpuBusy[cpu] = 1;
+            theJob->cpu = cpu;
+
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            sched_setaffinity(0, sizeof(cpu_set_t), &one);
+            return;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+int compareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void computeStat(double* values, int count, Stat* stat)
+{
+    double sum = 0, squares = 0, q1, q3, iqr;
+    int i;
+
+    memset(stat, 0, sizeof(Stat));
+    if(count == 0)
+    {
+        return;
+    }
+
+    qsort(values, count, sizeof(double), compareDoubles);
+    for(i = 0; i < count; i++)
+    {
+        sum += values[i];
+    }
+    stat->mean = sum / count;
+    for(i = 0; i < count; i++)
+    {
+        squares += (values[i] - stat->mean) * (values[i] - stat->mean);
+    }
+    stat->stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+    stat->min = values[0];
+    stat->median = count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+
+    q1 = values[count / 4];
+    q3 = values[(3 * count) / 4 < count ? (3 * count) / 4 : count - 1];
+    iqr = q3 - q1;
+    for(i = 0; i < count; i++)
+    {
+        if(values[i] < q1 - 1.5 * iqr || values[i] > q3 + 1.5 * iqr)
+        {
+            stat->outliers++;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void runBench(JobList* theList, int limit, int runs, int warmups, FILE* json)
+{
+    const char* names[3] = { "wall", "user", "sys" };
+    JobList bench;
+    Stat* stats;
+    double* values;
+    double value;
+    int commands, total, i, j, k, n, fastest = 0;
+
+    //every command is needed up front
+    while(jobAt(theList, theList->count) != NULL);
+    commands = theList->count;
+    if(commands == 0)
+    {
+        return;
+    }
+
+    //warmups first, then the measured runs, one round over all commands at
+    //a time so that drift over the whole benchmark hits every command alike
+    memset(&bench, 0, sizeof(JobList));
+    total = commands * (warmups + runs);
+    bench.jobs = (Job*) malloc(total * sizeof(Job));
+    for(i = 0; i < warmups + runs; i++)
+    {
+        for(j = 0; j < commands; j++)
+        {
+            Job* job = &bench.jobs[bench.count++];
+            initJob(job, theList->jobs[j].argv, theList->jobs[j].length, j + 1);
+            job->in = theList->jobs[j].in;
+            job->warmup = i < warmups;
+        }
+    }
+
+    if(captureMode != CAPTURE_NONE)
+    {
+        runCaptured(&bench, limit);
+    }
+    else
+    {
+        runJobs(&bench, limit);
+    }
+
+    printLine();
+    printf("Benchmark: %d command(s), %d warmup and %d measured run(s) each\n", commands, warmups,
+           runs);
+
+    stats = (Stat*) malloc(commands * 3 * sizeof(Stat));
+    values = (double*) malloc(runs * sizeof(double));
+
+    printf("%4s %5s %11s %11s %11s %11s %5s  %s\n", "CMD", "TIME", "MEAN(ms)", "STDDEV(ms)",
+           "MIN(ms)", "MEDIAN(ms)", "OUTL", "COMMAND");
+    for(j = 0; j < commands; j++)
+    {
+        for(k = 0; k < 3; k++)
+        {
+            n = 0;
+            for(i = 0; i < bench.count; i++)
+            {
+                Job* job = &bench.jobs[i];
+                if(job->id != j + 1 || job->warmup)
+                {
+                    continue;
+                }
+                value = k == 0 ? job->wallMs :
+                        k == 1 ? timevalMs(&job->usage.ru_utime) : timevalMs(&job->usage.ru_stime);
+                values[n++] = value;
+            }
+
+            computeStat(values, n, &stats[j * 3 + k]);
+            printf("%4d %5s %11.3f %11.3f %11.3f %11.3f %5d  ", j + 1, names[k],
+                   stats[j * 3 + k].mean, stats[j * 3 + k].stddev, stats[j * 3 + k].min,
+                   stats[j * 3 + k].median, stats[j * 3 + k].outliers);
+            if(k == 0)
+            {
+                printCmd(theList->jobs[j].argv, theList->jobs[j].length);
+            }
+            printf("\n");
+        }
+
+        if(stats[j * 3].mean < stats[fastest * 3].mean)
+        {
+            fastest = j;
+        }
+    }
+
+    //how many times faster the command of the row is than the one of the column
+    if(commands > 1)
+    {
+        printLine();
+        printf("Relative speed (mean wall time of column / row), fastest: CMD %d\n", fastest + 1);
+        printf("%4s", "");
+        for(j = 0; j < commands; j++)
+        {
+            printf(" %8d", j + 1);
+        }
+        printf("\n");
+        for(i = 0; i < commands; i++)
+        {
+            printf("%4d", i + 1);
+            for(j = 0; j < commands; j++)
+            {
+                printf(" %8.3f", stats[i * 3].mean > 0 ? stats[j * 3].mean / stats[i * 3].mean : 0);
+            }
+            printf("\n");
+        }
+    }
+
+    if(json != NULL)
+    {
+        printJsonReport(bench.jobs, bench.count, json);
+    }
+
+    free(values);
+    free(stats);
+    free(bench.jobs);
+}
+
+/////////////////////////////////////////////////////////////////
+
+uint64_t cacheKey(Job* theJob)
+{
+    unsigned char buffer[65536];
+    uint64_t hash = 14695981039346656037ULL;
+    ssize_t n, j;
+    int i, fd;
+
+    //the terminating NUL keeps "a b" and "ab" apart
+    for(i = 0; theJob->argv[i] != NULL; i++)
+    {
+        for(j = 0; j == 0 || theJob->argv[i][j - 1] != '\0'; j++)
+        {
+            hash = (hash ^ (unsigned char) theJob->argv[i][j]) * 1099511628211ULL;
+        }
+    }
+
+    for(i = 1; theJob->argv[i] != NULL; i++)
+    {
+        if(!isInputFile(theJob->argv[i]) ||
+           (fd = open(theJob->argv[i], O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            continue;
+        }
+
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        while((n = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            for(j = 0; j < n; j++)
+            {
+                hash = (hash ^ buffer[j]) * 1099511628211ULL;
+            }
+        }
+        close(fd);
+    }
+
+    return hash;
+}
+
+/////////////////////////////////////////////////////////////////
+
+char* cacheIdentity(Job* theJob, size_t* length)
+{
+    CacheInput input;
+    struct stat st;
+    size_t size = 0, len;
+    char* identity;
+    int i;
+
+    for(i = 0; theJob->argv[i] != NULL; i++)
+    {
+        size += strlen(theJob->argv[i]) + 1 + sizeof(CacheInput);
+    }
+    identity = (char*) malloc(size ? size : 1);
+    if(identity == NULL)
+    {
+        return NULL;
+    }
+
+    *length = 0;
+    for(i = 0; theJob->argv[i] != NULL; i++)
+    {
+        len = strlen(theJob->argv[i]) + 1;
+        memcpy(identity + *length, theJob->argv[i], len);
+        *length += len;
+    }
+
+    for(i = 1; theJob->argv[i] != NULL; i++)
+    {
+        if(stat(theJob->argv[i], &st) < 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        memset(&input, 0, sizeof(input));
+        input.size = st.st_size;
+        input.sec = st.st_mtim.tv_sec;
+        input.nsec = st.st_mtim.tv_nsec;
+        memcpy(identity + *length, &input, sizeof(input));
+        *length += sizeof(input);
+    }
+
+    return identity;
+}
+
+/////////////////////////////////////////////////////////////////
+
+int loadCache(Job* theJob)
+{
+    char path[4096];
+    CacheHeader header;
+    struct timespec end;
+    char* identity;
+    char* stored;
+    size_t length;
+    int fd, same;
+
+    clock_gettime(CLOCK_MONOTONIC, &theJob->start);
+    snprintf(path, sizeof(path), "%s/%016llx", cacheDir, (unsigned long long) theJob->key);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return 0;
+    }
+
+    if(read(fd, &header, sizeof(header)) != sizeof(header) ||
+       memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 || header.key != theJob->key)
+    {
+        close(fd);
+        return 0;
+    }
+
+    //an entry of another job with the same key, or of older input files, is a miss
+    identity = cacheIdentity(theJob, &length);
+    if(identity == NULL || header.identity != length)
+    {
+        free(identity);
+        close(fd);
+        return 0;
+    }
+    stored = (char*) malloc(length ? length : 1);
+    same = stored != NULL && read(fd, stored, length) == (ssize_t) length &&
+           memcmp(stored, identity, length) == 0;
+    free(stored);
+    free(identity);
+    if(!same)
+    {
+        close(fd);
+        return 0;
+    }
+
+    theJob->output = (char*) malloc(header.length ? header.length : 1);
+    if(theJob->output == NULL ||
+       read(fd, theJob->output, header.length) != (ssize_t) header.length)
+    {
+        //a truncated entry is run again and rewritten
+        free(theJob->output);
+        theJob->output = NULL;
+        close(fd);
+        return 0;
+    }
+
+    //the mtime is what the least recently used entries are found by
+    futimens(fd, NULL);
+    close(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    theJob->outputLen = theJob->outputCap = header.length;
+    theJob->status = header.status;
+    theJob->wallMs = elapsedMs(&theJob->start, &end);
+    theJob->cachedMs = header.wallMs;
+    theJob->reaped = 1;
+    theJob->cached = 1;
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////
+
+void storeCache(Job* theJob)
+{
+    char path[4096], temp[4096];
+    CacheHeader header;
+    struct stat spill;
+    off_t offset = 0;
+    uint64_t length = theJob->outputLen;
+    char* identity;
+    size_t identityLen;
+    ssize_t n = 0;
+    int fd;
+
+    if(theJob->spillFd >= 0)
+    {
+        //spilled output is all in the file, the buffer was emptied into it
+        if(fstat(theJob->spillFd, &spill) < 0)
+        {
+            return;
+        }
+        length = spill.st_size;
+    }
+
+    if(theJob->cached || theJob->pid <= 0 || theJob->status != 0 ||
+       (long long) length > cacheLimit)
+    {
+        return;
+    }
+
+    identity = cacheIdentity(theJob, &identityLen);
+    if(identity == NULL)
+    {
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.key = theJob->key;
+    header.status = theJob->status;
+    header.wallMs = theJob->wallMs;
+    header.identity = identityLen;
+    header.length = length;
+
+    //written under a temporary name and renamed, so that a reader never
+    //sees half an entry
+    snprintf(temp, sizeof(temp), "%s/.tmp-XXXXXX", cacheDir);
+    fd = mkstemp(temp);
+    if(fd < 0)
+    {
+        free(identity);
+        return;
+    }
+
+    if(write(fd, &header, sizeof(header)) != sizeof(header) ||
+       write(fd, identity, identityLen) != (ssize_t) identityLen)
+    {
+        n = -1;
+    }
+    else if(theJob->spillFd >= 0)
+    {
+        //the offset is our own, the file is still read from 0 when emitted
+        while(offset < (off_t) length &&
+              (n = sendfile(fd, theJob->spillFd, &offset, length - offset)) > 0);
+    }
+    else
+    {
+        n = write(fd, theJob->output, theJob->outputLen);
+        offset = n < 0 ? 0 : n;
+    }
+    free(identity);
+
+    if(offset != (off_t) length || n < 0)
+    {
+        close(fd);
+        unlink(temp);
+        return;
+    }
+    close(fd);
+
+    snprintf(path, sizeof(path), "%s/%016llx", cacheDir, (unsigned long long) theJob->key);
+    if(rename(temp, path) < 0)
+    {
+        unlink(temp);
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+
+int compareCacheFiles(const void* a, const void* b)
+{
+    const CacheFile* x = (const CacheFile*) a;
+    const CacheFile* y = (const CacheFile*) b;
+
+    if(x->mtime.tv_sec != y->mtime.tv_sec)
+    {
+        return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    }
+    return (x->mtime.tv_nsec > y->mtime.tv_nsec) - (x->mtime.tv_nsec < y->mtime.tv_nsec);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void trimCache()
+{
+    CacheFile* files = NULL;
+    struct dirent* entry;
+    struct stat st;
+    long long total = 0;
+    int count = 0, capacity = 0, i, dirFd;
+    DIR* dir;
+
+    dir = opendir(cacheDir);
+    if(dir == NULL)
+    {
+        return;
+    }
+    dirFd = dirfd(dir);
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        //only entries have 16 character names
+        if(strlen(entry->d_name) != 16 || fstatat(dirFd, entry->d_name, &st, 0) < 0 ||
+           !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+
+        if(count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            files = (CacheFile*) realloc(files, capacity * sizeof(CacheFile));
+        }
+        strcpy(files[count].name, entry->d_name);
+        files[count].size = st.st_size;
+        files[count].mtime = st.st_mtim;
+        total += st.st_size;
+        count++;
+    }
+
+    if(total > cacheLimit)
+    {
+        qsort(files, count, sizeof(CacheFile), compareCacheFiles);
+        for(i = 0; i < count && total > cacheLimit; i++)
+        {
+            if(unlinkat(dirFd, files[i].name, 0) == 0)
+            {
+                total -= files[i].size;
+            }
+        }
+    }
+
+    closedir(dir);
+    free(files);
+}
+
+///////////////////////////////////////////////////////////
+/////////////////////MAIN//////////////////////////////////
+///////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    int limit = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int length, opt, i, limitSet = 0;
+    int benchCount = 0, ballastMb = 0, pipeline = 0, teeOut = 0, runs = 0, warmups = 0;
+    char* outFile = NULL;
+    char* batchFile = NULL;
+    FILE* json = NULL;
+    char** theScript;
+    JobList list;
+
+    memset(&list, 0, sizeof(JobList));
+    list.in = -1;
+
+    //-j: how many commands may run at the same time (default: online CPUs,
+    //    but 1 with -r; more is faster, but the runs then time each other)
+    //-J: also write the final report as JSON to this file, away from the
+    //    prompts and the output of the commands on stdout
+    //-s: how children are started: fork, vfork or spawn (default)
+    //-B: benchmark every spawn backend with that many children and exit
+    //-m: MB of memory the parent touches before the -B benchmark
+    //-p: run the commands as a pipeline, only the first one gets the file
+    //-o: with -p, capture the output of the last stage into this file
+    //-t: with -o, also copy the captured output to stdout
+    //-c: capture the output of every command and print it in one piece,
+    //    in the order the commands finish (done) or were entered (order)
+    //-f: read the commands from this file (- for stdin), one per line,
+    //    instead of prompting for them
+    //-F: the file argument added at the end of every command, instead of
+    //    prompting for it
+    //-r: benchmark every command with this many measured runs
+    //-w: with -r, the number of unmeasured runs done first
+    //-k: with -r, drop the input files from the page cache before every run
+    //    (drop) or read them into it (warm)
+    //-P: pin every running command to its own CPU
+    //-C: replay commands that succeeded before from this cache directory
+    //-L: with -C, the MB the cache may take before old entries are removed
+    while((opt = getopt(argc, argv, "j:J:s:B:m:po:tc:f:F:r:w:k:PC:L:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'C':
+                cacheDir = optarg;
+                break;
+            case 'L':
+                cacheLimit = atoll(optarg) << 20;
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'w':
+                warmups = atoi(optarg);
+                break;
+            case 'k':
+                if(strcmp(optarg, "drop") == 0)
+                {
+                    cacheMode = CACHE_DROP;
+                }
+                else if(strcmp(optarg, "warm") == 0)
+                {
+                    cacheMode = CACHE_WARM;
+                }
+                else
+                {
+                    fprintf(stderr, "unknown cache mode '%s' (drop or warm)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                pinCpus = 1;
+                break;
+            case 'f':
+                batchFile = optarg;
+                break;
+            case 'F':
+                list.file = strdup(optarg);
+                break;
+            case 'c':
+                if(strcmp(optarg, "done") == 0)
+                {
+                    captureMode = CAPTURE_DONE;
+                }
+                else if(strcmp(optarg, "order") == 0)
+                {
+                    captureMode = CAPTURE_ORDER;
+                }
+                else
+                {
+                    fprintf(stderr, "unknown capture order '%s' (done or order)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'p':
+                pipeline = 1;
+                break;
+            case 'o':
+                outFile = optarg;
+                break;
+            case 't':
+                teeOut = 1;
+                break;
+            case 's':
+                for(spawnBackend = 0; spawnBackend < SPAWN_BACKENDS; spawnBackend++)
+                {
+                    if(strcmp(optarg, spawnNames[spawnBackend]) == 0)
+                    {
+                        break;
+                    }
+                }
+                if(spawnBackend == SPAWN_BACKENDS)
+                {
+                    fprintf(stderr, "unknown spawn backend '%s' (fork, vfork or spawn)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'B':
+                benchCount = atoi(optarg);
+                break;
+            case 'm':
+                ballastMb = atoi(optarg);
+                break;
+            case 'j':
+                limit = atoi(optarg);
+                limitSet = 1;
+                break;
+            case 'J':
+                json = fopen(optarg, "we");
+                if(json == NULL)
+                {
+                    fprintf(stderr, "cannot create %s: %s\n", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-j jobs] [-J file] [-s fork|vfork|spawn] [-B count [-m MB]]\n"
+                        "       [-p [-o file [-t]] | -c done|order] [-f batch|- [-F file]]\n"
+                        "       [-r runs [-w warmups] [-k drop|warm]] [-P] [-C dir [-L MB]]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if(runs > 0 && !limitSet)
+    {
+        //runs side by side compete for the CPUs, caches and disk, and with
+        //-k drop evict each other's files, so a benchmark runs one at a time
+        limit = 1;
+    }
+
+    if(pinCpus)
+    {
+        //no more jobs than CPUs, so that every job gets a CPU of its own
+        sched_getaffinity(0, sizeof(cpu_set_t), &pinSet);
+        if(limit > CPU_COUNT(&pinSet))
+        {
+            limit = CPU_COUNT(&pinSet);
+        }
+    }
+
+    if(limit < 1)
+    {
+        limit = 1;
+    }
+
+    if(benchCount > 0)
+    {
+        benchSpawn(benchCount, ballastMb);
+        return 0;
+    }
+
+    if(cacheDir != NULL && (runs > 0 || pipeline))
+    {
+        //benchmarks must run every time and pipeline stages are not separate
+        cacheDir = NULL;
+    }
+    else if(cacheDir != NULL)
+    {
+        if(mkdir(cacheDir, 0777) < 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "cannot create %s: %s\n", cacheDir, strerror(errno));
+            return 1;
+        }
+
+        //the output has to be captured to be cached
+        if(captureMode == CAPTURE_NONE)
+        {
+            captureMode = CAPTURE_ORDER;
+        }
+    }
+
+    if(batchFile != NULL)
+    {
+        //commands are read as they are needed, so the first ones start
+        //before the batch file was read completely
+        list.source = strcmp(batchFile, "-") == 0 ? stdin : fopen(batchFile, "re");
+        if(list.source == NULL)
+        {
+            fprintf(stderr, "cannot open %s: %s\n", batchFile, strerror(errno));
+            return 1;
+        }
+
+        //children must not eat the commands that are still to be read
+        if(list.source == stdin)
+        {
+            list.in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+    }
+    else
+    {
+        //read commands until an empty line
+        while((length = getCmd(&theScript, list.count + 1)) > 0)
+        {
+            addJob(&list, theScript, length);
+        }
+
+        if(list.count == 0)
+        {
+            return 0;
+        }
+
+        //-F already named the file
+        if(list.file == NULL)
+        {
+            printf("file>");
+            fflush(stdout);
+            length = getline(&list.line, &list.lineCap, stdin);
+            if(length > 0 && parseCmd(list.line, length, &theScript) > 0)
+            {
+                list.file = strdup(theScript[0]);
+                free(theScript);
+            }
+        }
+
+        //every command gets the file as its last argument
+        for(i = 0; i < list.count; i++)
+        {
+            list.jobs[i].argv[list.jobs[i].length - 2] = list.file;
+        }
+    }
+
+    if(runs > 0)
+    {
+        //a pipeline has no separate commands to compare
+        pipeline = 0;
+        runBench(&list, limit, runs, warmups < 0 ? 0 : warmups, json);
+    }
+    else if(pipeline)
+    {
+        //every stage is started at once, so the whole batch is needed; only
+        //the first stage gets the file, the others read their stdin
+        while(jobAt(&list, list.count) != NULL);
+        for(i = 1; i < list.count; i++)
+        {
+            list.jobs[i].argv[list.jobs[i].length - 2] = NULL;
+        }
+
+        //the stages of a pipeline share their output, there is nothing to capture
+        captureMode = CAPTURE_NONE;
+        runPipeline(list.jobs, list.count, outFile, teeOut);
+    }
+    else if(captureMode != CAPTURE_NONE)
+    {
+        runCaptured(&list, limit);
+    }
+    else
+    {
+        runJobs(&list, limit);
+    }
+
+    if(cacheDir != NULL)
+    {
+        trimCache();
+    }
+
+    if(runs <= 0)
+    {
+        printLine();
+        printf("Done waiting on children: %d\n", list.count);
+
+        printReport(list.jobs, list.count);
+        if(json != NULL)
+        {
+            printJsonReport(list.jobs, list.count, json);
+        }
+    }
+
+    if(json != NULL)
+    {
+        fclose(json);
+    }
+
+    for(i = 0; i < list.count; i++)
+    {
+        free(list.jobs[i].argv);
+    }
+    free(list.jobs);
+    free(list.line);
+    free(list.file);
+
     return 0;
 }
@@ -2,29 +2,105 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <assert.h>
+#include "matrix.h"
+
+// SMALL MATRIX KERNELS
+//
+// Most tasks are tiny (5x5, 10x10), so the generic loops below are mostly
+// fixed overhead for them.  For the dimensions listed in SMALL_DIMS we
+// generate one kernel per (row, col) pair at compile time.  The trip counts
+// are constants, so gcc fully unrolls (and vectorizes) the loops.  Kernels
+// rely on AllocMatrix() laying the rows out contiguously.
+
+#define SMALL_DIMS(X, R) X(R, 4) X(R, 5) X(R, 8) X(R, 10) X(R, 16) X(R, 32)
+#define SMALL_KERNELS(X) \
+  SMALL_DIMS(X, 4) SMALL_DIMS(X, 5) SMALL_DIMS(X, 8) \
+  SMALL_DIMS(X, 10) SMALL_DIMS(X, 16) SMALL_DIMS(X, 32)
+#define NUM_SMALL_DIMS 6
+
+typedef struct __matrix_kernel {
+  int (*sum)(int ** matrix);
+  void (*fill)(int ** matrix, int type);
+} matrix_kernel;
+
+#define DEFINE_KERNEL(R, C) \
+static int SumMatrix_##R##x##C(int ** matrix) \
+{ \
+  const int * mm = matrix[0]; \
+  int sum = 0; \
+  int k; \
+  _Pragma("GCC unroll 1024") \
+  for (k = 0; k < (R) * (C); k++) \
+    sum += mm[k]; \
+  return sum; \
+} \
+static void FillMatrix_##R##x##C(int ** matrix, int type) \
+{ \
+  int * mm = matrix[0]; \
+  int i, j; \
+  _Pragma("GCC unroll 32") \
+  for (i = 0; i < (R); i++) \
+  { \
+    _Pragma("GCC unroll 32") \
+    for (j = 0; j < (C); j++) \
+      mm[i * (C) + j] = (type == 1) ? 1 : j; \
+  } \
+}
+
+#define KERNEL_ENTRY(R, C) { SumMatrix_##R##x##C, FillMatrix_##R##x##C },
+
+SMALL_KERNELS(DEFINE_KERNEL)
+
+// Dispatch table, indexed by SmallDimSlot(row) * NUM_SMALL_DIMS + SmallDimSlot(col)
+static const matrix_kernel kernels[NUM_SMALL_DIMS * NUM_SMALL_DIMS] = {
+  SMALL_KERNELS(KERNEL_ENTRY)
+};
+
+static int SmallDimSlot(int d)
+{
+  switch (d)
+  {
+    case 4:  return 0;
+    case 5:  return 1;
+    case 8:  return 2;
+    case 10: return 3;
+    case 16: return 4;
+    case 32: return 5;
+    default: return -1;
+  }
+}
+
+// Returns the specialized kernel for a (row, col) pair, or NULL if the
+// generic path has to be used.
+static const matrix_kernel * FindKernel(int r, int c)
+{
+  int rs = SmallDimSlot(r);
+  int cs = SmallDimSlot(c);
+  if (rs < 0 || cs < 0)
+    return NULL;
+  return &kernels[rs * NUM_SMALL_DIMS + cs];
+}
 
 // MATRIX ROUTINES
+// The row table and the row data share one allocation, so rows are
+// contiguous and the whole matrix is a single malloc/free.
 int ** AllocMatrix(int r, int c)
 {
   int ** a;
+  int * data;
   int i;
-  a = (int**) malloc(sizeof(int *) * r);
+  a = (int**) malloc(sizeof(int *) * r + sizeof(int) * r * c);
   assert(a != 0);
+  data = (int *) (a + r);
   for (i = 0; i < r; i++)
   {
-    a[i] = (int *) malloc(c * sizeof(int));
-    assert(a[i] != 0);
+    a[i] = data + i * c;
   }
   return a;
 }
 
 void FreeMatrix(int ** a, int r, int c)
 {
-  int i;
-  for (i=0; i<r; i++)
-  {
-    free(a[i]);
-  }
   free(a);
 }
 
@@ -35,6 +111,17 @@ void GenMatrixType(int ** matrix, const int height, const int width, int type)
     type = 100;
   if (type < 1)
     type = 1;
+#if !OUTPUT
+  if (type <= 2)
+  {
+    const matrix_kernel * k = FindKernel(height, width);
+    if (k != NULL)
+    {
+      k->fill(matrix, type);
+      return;
+    }
+  }
+#endif
   for (i = 0; i < height; i++)
   {
     for (j = 0; j < width; j++)
@@ -63,15 +150,19 @@ void GenMatrix(int ** matrix, const int height, const int width)
   GenMatrixType(matrix, height, width, 1);
 }
 
-// TO DO
-// Implement the AvgElement function
 int AvgElement(int ** matrix, const int height, const int width)
 {
-  return 1;
+  if (height <= 0 || width <= 0)
+    return 0;
+  return SumMatrix(matrix, height, width) / (height * width);
 }
 
 int SumMatrix(int ** matrix, const int height, const int width)
 {
+  const matrix_kernel * k = FindKernel(height, width);
+  if (k != NULL)
+    return k->sum(matrix);
+
   int sum=0;
   int y=0;
   int i, j;
@@ -87,23 +178,56 @@ int SumMatrix(int ** matrix, const int height, const int width)
   return sum;
 }
 
+// Formats y like "%3d" into out and returns the number of characters written.
+static int FormatCell(char * out, int y)
+{
+  char digits[12];
+  unsigned int v = (y < 0) ? 0u - (unsigned int) y : (unsigned int) y;
+  int n = 0, len = 0;
+  do
+  {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v != 0);
+  if (y < 0)
+    digits[n++] = '-';
+  while (len + n < 3)
+    out[len++] = ' ';
+  while (n > 0)
+    out[len++] = digits[--n];
+  return len;
+}
+
+// Rows are formatted into a local buffer and written with one fwrite per
+// buffer, instead of one fprintf per element.
 void DisplayMatrix(int ** matrix, const int height, const int width, FILE *stream)
 {
-  int y=0;
+  char line[4096];
+  int len = 0;
   int i, j;
   for (i=0; i<height; i++)
   { 
     int *mm = matrix[i];
-    fprintf(stream, "|");
+    line[len++] = '|';
     for (j=0; j<width; j++)
     {
-      y=mm[j];
-      if (j==0)  
-        fprintf(stream, "%3d",y);
-      else
-        fprintf(stream, " %3d",y);
+      if (len > (int) sizeof(line) - 16)
+      {
+        fwrite(line, 1, len, stream);
+        len = 0;
+      }
+      if (j!=0)
+        line[len++] = ' ';
+      len += FormatCell(line + len, mm[j]);
+    }
+    line[len++] = '|';
+    line[len++] = '\n';
+    if (len > (int) sizeof(line) - 16)
+    {
+      fwrite(line, 1, len, stream);
+      len = 0;
     }
-    fprintf(stream, "|\n");
   }
+  if (len > 0)
+    fwrite(line, 1, len, stream);
 }
-
@@ -14,10 +14,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <string.h>
 #include <time.h>
 #include "matrix.h"
 #include "tasks.h"
 #include "pcmatrix.h"
+#include "resultlog.h"
 
 int main (int argc, char * argv[])
 {
@@ -32,6 +34,14 @@ int main (int argc, char * argv[])
   }
   */
 
+  // -l : append sum/avg results to the binary result log in tasks_output
+  //      instead of creating one .sum/.avg file per task (see rlquery)
+  if (argc == 2 && strcmp(argv[1], "-l") == 0)
+  {
+    if (OpenResultLog("tasks_output") != 0)
+      return 1;
+  }
+
   // Uncomment to see example operation of the dotasks() routine
   //dotasks((void *) NULL);
   
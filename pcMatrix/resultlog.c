@@ -0,0 +1,181 @@
+/*
+ *  Binary result log for the matrix task processor
+ *  See resultlog.h for the on-disk layout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "resultlog.h"
+
+#define SEGMENT_SIZE (sizeof(result_header) + RESULTLOG_RECORDS * sizeof(result_record))
+
+static char log_dir[256];
+static int log_enabled = 0;
+static int log_segment = -1;
+static result_header * log_header = NULL;
+static result_record * log_records = NULL;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t HashName(const char * name)
+{
+  uint64_t h = 14695981039346656037ULL;
+  while (*name)
+  {
+    h ^= (unsigned char) *name++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+void ResultLogSegmentName(char * out, int len, const char * dir, int seg)
+{
+  snprintf(out, len, "%s/results.%06d.log", dir, seg);
+}
+
+/*
+ *  Maps segment number seg, creating and sizing it if needed.
+ *  The header is set up under flock() since other processes may be
+ *  mapping the same segment.
+ */
+static int MapSegment(int seg)
+{
+  char filename[512];
+  result_header * hdr;
+  result_record * records;
+  uint32_t slot, next;
+  void * base;
+  int fd;
+
+  ResultLogSegmentName(filename, sizeof(filename), log_dir, seg);
+  fd = open(filename, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Error : Failed to open result log %s - %s\n", filename, strerror(errno));
+    return -1;
+  }
+  if (ftruncate(fd, SEGMENT_SIZE) != 0)
+  {
+    fprintf(stderr, "Error : Failed to size result log %s - %s\n", filename, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  base = mmap(NULL, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+  {
+    fprintf(stderr, "Error : Failed to map result log %s - %s\n", filename, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  flock(fd, LOCK_EX);
+  hdr = (result_header *) base;
+  records = (result_record *) (hdr + 1);
+  if (hdr->magic[0] == '\0')
+  {
+    memcpy(hdr->magic, RESULTLOG_MAGIC, sizeof(RESULTLOG_MAGIC));
+    hdr->version = RESULTLOG_VERSION;
+    hdr->record_size = sizeof(result_record);
+    hdr->records = RESULTLOG_RECORDS;
+  }
+  else if (memcmp(hdr->magic, RESULTLOG_MAGIC, sizeof(RESULTLOG_MAGIC)) != 0 ||
+           hdr->record_size != sizeof(result_record))
+  {
+    fprintf(stderr, "Error : %s is not a result log\n", filename);
+    flock(fd, LOCK_UN);
+    close(fd);
+    munmap(base, SEGMENT_SIZE);
+    return -1;
+  }
+  else if (hdr->version < RESULTLOG_VERSION)
+  {
+    // a version 1 segment has a single writer, next resumes after its records
+    slot = 0;
+    while (slot < RESULTLOG_RECORDS && records[slot].op != 0)
+      slot++;
+    next = __atomic_load_n(&hdr->next, __ATOMIC_RELAXED);
+    while (next < slot &&
+           !__atomic_compare_exchange_n(&hdr->next, &next, slot, 0, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+      ;
+    __atomic_store_n(&hdr->version, RESULTLOG_VERSION, __ATOMIC_RELEASE);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  if (log_header != NULL)
+    munmap(log_header, SEGMENT_SIZE);
+  log_header = hdr;
+  log_records = records;
+  log_segment = seg;
+  return 0;
+}
+
+int OpenResultLog(const char * dir)
+{
+  char filename[512];
+  int seg = 0;
+
+  snprintf(log_dir, sizeof(log_dir), "%s", dir);
+  mkdir(log_dir, 0755);
+
+  // find the newest existing segment
+  ResultLogSegmentName(filename, sizeof(filename), log_dir, seg + 1);
+  while (access(filename, F_OK) == 0)
+  {
+    seg++;
+    ResultLogSegmentName(filename, sizeof(filename), log_dir, seg + 1);
+  }
+
+  if (MapSegment(seg) != 0)
+    return -1;
+  log_enabled = 1;
+  printf("Appending results to log segment %d slot %u in dir='%s'\n", log_segment,
+         __atomic_load_n(&log_header->next, __ATOMIC_RELAXED), log_dir);
+  return 0;
+}
+
+int ResultLogEnabled(void)
+{
+  return log_enabled;
+}
+
+void AppendResult(char op, const char * name, int row, int col, int ele,
+                  int64_t value, uint64_t start_ns, uint64_t end_ns)
+{
+  result_record * r;
+  uint32_t slot;
+
+  // the mutex only keeps the segment mapped, the slot is claimed in the
+  // segment itself so that other processes appending to it get other ones
+  pthread_mutex_lock(&log_lock);
+
+  while ((slot = __atomic_fetch_add(&log_header->next, 1, __ATOMIC_RELAXED)) >= RESULTLOG_RECORDS)
+  {
+    if (MapSegment(log_segment + 1) != 0)
+    {
+      pthread_mutex_unlock(&log_lock);
+      return;
+    }
+  }
+
+  r = &log_records[slot];
+  r->name_hash = HashName(name);
+  r->row = row;
+  r->col = col;
+  r->ele = ele;
+  r->value = value;
+  r->start_ns = start_ns;
+  r->end_ns = end_ns;
+  strncpy(r->name, name, RESULTLOG_NAMELEN - 1);
+  __atomic_store_n(&r->op, op, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&log_lock);
+}
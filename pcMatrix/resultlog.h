@@ -0,0 +1,60 @@
+/*
+ *  Binary result log for the matrix task processor
+ *
+ *  Instead of creating one small file per sum/avg task, results can be
+ *  appended as fixed-size records to a segmented, memory-mapped log in
+ *  the tasks_output directory (results.000000.log, results.000001.log, ...).
+ *
+ *  Each segment starts with a header slot followed by RESULTLOG_RECORDS
+ *  record slots.  Writers claim a slot by atomically bumping next in the
+ *  header, so several pcMatrix processes can share one log directory.
+ *  A slot is committed once its op field is non-zero; readers scan a
+ *  segment up to next and skip the empty slots, which are still being
+ *  written or were lost with their writer.  Version 1 segments have no
+ *  next and end at the first empty slot.
+ */
+
+#include <stdint.h>
+
+#define RESULTLOG_MAGIC "PCRLOG1"
+#define RESULTLOG_VERSION 2
+#define RESULTLOG_RECORDS 16384
+#define RESULTLOG_NAMELEN 16
+
+typedef struct __result_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t records;
+  uint32_t next;          // slots claimed so far, may run past records
+  char pad[40];
+} result_header;
+
+typedef struct __result_record {
+  uint64_t name_hash;     // FNV-1a hash of the full matrix name
+  char op;                // 's' or 'a', written last to commit the record
+  char pad[3];
+  int32_t row;
+  int32_t col;
+  int32_t ele;
+  int64_t value;
+  uint64_t start_ns;      // CLOCK_REALTIME when the task was dequeued
+  uint64_t end_ns;        // CLOCK_REALTIME when the result was computed
+  char name[RESULTLOG_NAMELEN];  // matrix name, truncated and NUL terminated
+} result_record;
+
+// Hashes a matrix name the way records are keyed
+uint64_t HashName(const char * name);
+
+// Opens (or resumes) the log in dir; returns 0 on success
+int OpenResultLog(const char * dir);
+
+// Returns non-zero once OpenResultLog() succeeded
+int ResultLogEnabled(void);
+
+// Appends one result record, rolling over to a new segment when full
+void AppendResult(char op, const char * name, int row, int col, int ele,
+                  int64_t value, uint64_t start_ns, uint64_t end_ns);
+
+// Builds the file name of segment number seg in dir
+void ResultLogSegmentName(char * out, int len, const char * dir, int seg);
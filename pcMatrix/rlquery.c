@@ -0,0 +1,94 @@
+/*
+ *  rlquery - looks up results in the pcMatrix binary result log
+ *
+ *  usage: rlquery name [dir]
+ *
+ *  Scans every segment of the result log in dir (default tasks_output)
+ *  and prints the sum/avg records stored for the matrix called name.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "resultlog.h"
+
+#define SEGMENT_SIZE (sizeof(result_header) + RESULTLOG_RECORDS * sizeof(result_record))
+
+int main(int argc, char * argv[])
+{
+  const char * dir = "tasks_output";
+  char filename[512];
+  char name[RESULTLOG_NAMELEN];
+  uint64_t hash;
+  int seg, found = 0;
+
+  if (argc < 2 || argc > 3)
+  {
+    fprintf(stderr, "usage: %s name [dir]\n", argv[0]);
+    return 2;
+  }
+  if (argc == 3)
+    dir = argv[2];
+
+  hash = HashName(argv[1]);
+  snprintf(name, sizeof(name), "%s", argv[1]);
+
+  for (seg = 0; ; seg++)
+  {
+    result_header * hdr;
+    result_record * r;
+    uint32_t end;
+    int i, fd;
+
+    ResultLogSegmentName(filename, sizeof(filename), dir, seg);
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+      break;
+    hdr = mmap(NULL, SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+    {
+      perror(filename);
+      return 1;
+    }
+    if (memcmp(hdr->magic, RESULTLOG_MAGIC, sizeof(RESULTLOG_MAGIC)) != 0 ||
+        hdr->record_size != sizeof(result_record))
+    {
+      fprintf(stderr, "%s is not a result log\n", filename);
+      munmap(hdr, SEGMENT_SIZE);
+      return 1;
+    }
+
+    // slots up to next may still be empty while their writer is busy
+    r = (result_record *) (hdr + 1);
+    end = hdr->version >= 2 ? __atomic_load_n(&hdr->next, __ATOMIC_ACQUIRE) : RESULTLOG_RECORDS;
+    if (end > RESULTLOG_RECORDS)
+      end = RESULTLOG_RECORDS;
+    for (i = 0; i < (int) end; i++)
+    {
+      char op = __atomic_load_n(&r[i].op, __ATOMIC_ACQUIRE);
+      if (op == 0 && hdr->version < 2)
+        break;
+      if (op == 0)
+        continue;
+      if (r[i].name_hash != hash || strncmp(r[i].name, name, RESULTLOG_NAMELEN) != 0)
+        continue;
+      printf("%s %s=%lld row=%d col=%d ele=%d start=%llu took=%lluns\n",
+             argv[1], op == 's' ? "sum" : "avg", (long long) r[i].value,
+             r[i].row, r[i].col, r[i].ele, (unsigned long long) r[i].start_ns,
+             (unsigned long long) (r[i].end_ns - r[i].start_ns));
+      found++;
+    }
+    munmap(hdr, SEGMENT_SIZE);
+  }
+
+  if (seg == 0)
+  {
+    fprintf(stderr, "No result log in dir='%s'\n", dir);
+    return 1;
+  }
+  return found ? 0 : 1;
+}
@@ -23,6 +23,7 @@
 #include <tasks.h>
 #include "matrix.h"
 #include "taskbuffer.h"
+#include "resultlog.h"
 
 // Maximum command filename length
 #define MAXFILENAMELEN 256
@@ -81,6 +82,14 @@ void sleepms(int theMS)
   usleep(theMS * 1000);
 }
 
+// Wall clock time in ns, used to timestamp result log records
+uint64_t nowns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 // Implement Bounded Buffer put() here
 void put(char * theTask) {
 
@@ -305,6 +314,7 @@ void *dotasks(void * arg)
     pthread_mutex_unlock(&b.lock);
 
     printf("***************DO TASK: '%s'\n",task);
+    uint64_t start_ns = nowns();
 
     task_t * newtask = processTask(task);
 
@@ -333,11 +343,18 @@ void *dotasks(void * arg)
         break;
       case 's':
       {
+        matrix = AllocMatrix(newtask->row,newtask->col);
+        GenMatrixType(matrix,newtask->row, newtask->col, newtask->ele);
+        if (ResultLogEnabled())
+        {
+          AppendResult('s', newtask->name, newtask->row, newtask->col, newtask->ele,
+                       SumMatrix(matrix,newtask->row,newtask->col), start_ns, nowns());
+          FreeMatrix(matrix,newtask->row,newtask->col);
+          break;
+        }
         char cwd[1024];
         if (!(getcwd(cwd, sizeof(cwd)) != NULL))
           fprintf(stderr, "getcwd error\n");
-        matrix = AllocMatrix(newtask->row,newtask->col);
-        GenMatrixType(matrix,newtask->row, newtask->col, newtask->ele);
         char tmpfilename[FULLFILENAME];
         sprintf(tmpfilename,"%s/%s/%s.sum",cwd,out_dir,newtask->name);
         matrix_file = fopen(tmpfilename, "w");
@@ -352,15 +369,23 @@ void *dotasks(void * arg)
         //
         // Implement Average Command
 
+        matrix = AllocMatrix(newtask->row,newtask->col);
+        GenMatrixType(matrix,newtask->row, newtask->col, newtask->ele);
+
+        if (ResultLogEnabled())
+        {
+          AppendResult('a', newtask->name, newtask->row, newtask->col, newtask->ele,
+                       AvgElement(matrix,newtask->row,newtask->col), start_ns, nowns());
+          FreeMatrix(matrix,newtask->row,newtask->col);
+          break;
+        }
+
         char cwd[1024];
         if (!(getcwd(cwd, sizeof(cwd)) != NULL)) 
         {
           fprintf(stderr, "getcwd error\n");
         }
 
-        matrix = AllocMatrix(newtask->row,newtask->col);
-        GenMatrixType(matrix,newtask->row, newtask->col, newtask->ele);
-
         char tmpfilename[FULLFILENAME];
         sprintf(tmpfilename,"%s/%s/%s.avg",cwd,out_dir,newtask->name);
 
@@ -0,0 +1,86 @@
+/*
+ *  Compares the ways of reading the process reporter
+ *
+ *  usage: prbench [iterations [filter]]
+ *
+ *  Every iteration takes one full report the way a poller would and walks
+ *  its records; the wall and CPU time (user and kernel) per iteration are
+ *  printed for the text report, the binary read() and the mmap() snapshot.
+ *  A filter, such as "states=R", is written to the report before each read.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "prlib.h"
+
+typedef struct __pr_method {
+  const char * name;
+  int (*take)(pr_snapshot * snap);
+} pr_method;
+
+static const pr_method methods[] = {
+  { "text", PrReadText },
+  { "binary", PrReadSnapshot },
+  { "mmap", PrMapSnapshot },
+};
+
+static double NowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double CpuMs(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+int main(int argc, char ** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100;
+  pr_snapshot snap;
+  double wall, cpu;
+  unsigned long long sum;
+  unsigned int m, i, count = 0;
+  int it;
+
+  if (iterations < 1)
+    iterations = 1;
+
+  printf("%-8s %10s %10s %9s\n", "METHOD", "WALL(ms)", "CPU(ms)", "RECORDS");
+  for (m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+    memset(&snap, 0, sizeof(snap));
+    snap.filter = argc > 2 ? argv[2] : NULL;
+
+    // one untimed round sizes the buffers and the mapping
+    if (methods[m].take(&snap) < 0) {
+      printf("%-8s failed: %s\n", methods[m].name, strerror(errno));
+      PrReleaseSnapshot(&snap, 1);
+      continue;
+    }
+
+    sum = 0;
+    wall = NowMs();
+    cpu = CpuMs();
+    for (it = 0; it < iterations; it++) {
+      if (methods[m].take(&snap) < 0)
+        break;
+      count = snap.count;
+      for (i = 0; i < snap.count; i++)
+        sum += PrRecord(&snap, i)->pid + PrRecord(&snap, i)->children;
+    }
+    wall = (NowMs() - wall) / iterations;
+    cpu = (CpuMs() - cpu) / iterations;
+
+    printf("%-8s %10.3f %10.3f %9u\n", methods[m].name, wall, cpu, count);
+    PrReleaseSnapshot(&snap, 1);
+  }
+
+  return 0;
+}
@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "prlib.h"
+
+// Reads the whole of an open file into *buf, growing it as needed;
+// returns the number of bytes read or -1
+static ssize_t ReadAll(int fd, char ** buf, size_t * capacity) {
+  size_t len = 0;
+  ssize_t n;
+
+  while (1) {
+    if (*capacity - len < 65536) {
+      *capacity = *capacity ? *capacity * 2 : 1 << 20;
+      *buf = realloc(*buf, *capacity);
+      if (*buf == NULL)
+        return -1;
+    }
+    n = read(fd, *buf + len, *capacity - len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      return len;
+    len += n;
+  }
+}
+
+// Checks the header at the start of data; returns 0 if it can be read
+static int CheckHeader(const struct pr_header * header, size_t len) {
+  if (len < sizeof(*header) || header->magic != PR_MAGIC ||
+      header->version != PR_VERSION || header->header_size < sizeof(*header) ||
+      header->record_size < sizeof(struct pr_record)) {
+    errno = EPROTO;
+    return -1;
+  }
+  return 0;
+}
+
+// Opens a report and sets the filter of the snapshot on it; returns the
+// fd or -1
+static int OpenReport(const char * path, const pr_snapshot * snap) {
+  size_t len;
+  int fd;
+
+  fd = open(path, (snap->filter ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  if (fd < 0 || snap->filter == NULL)
+    return fd;
+
+  len = strlen(snap->filter);
+  if (write(fd, snap->filter, len) != (ssize_t) len) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Parses the selected fields that follow a text record into it
+static void ParseFields(const char * tail, struct pr_record * record) {
+  unsigned long long utime, stime;
+  const char * field;
+  char * end;
+  int i;
+
+  if ((field = strstr(tail, " threads=")) != NULL &&
+      sscanf(field, " threads=%u", &record->threads) == 1)
+    record->fields |= PR_FIELD_THREADS;
+  if ((field = strstr(tail, " utime_ms=")) != NULL &&
+      sscanf(field, " utime_ms=%llu stime_ms=%llu", &utime, &stime) == 2) {
+    record->utime_ns = utime * 1000000;
+    record->stime_ns = stime * 1000000;
+    record->fields |= PR_FIELD_TIMES;
+  }
+  if ((field = strstr(tail, " rss_kb=")) != NULL &&
+      sscanf(field, " rss_kb=%llu", (unsigned long long *) &record->rss_kb) == 1)
+    record->fields |= PR_FIELD_RSS;
+  if ((field = strstr(tail, " nvcsw=")) != NULL &&
+      sscanf(field, " nvcsw=%llu nivcsw=%llu", (unsigned long long *) &record->nvcsw,
+             (unsigned long long *) &record->nivcsw) == 2)
+    record->fields |= PR_FIELD_CTXSW;
+  if ((field = strstr(tail, " children=")) != NULL) {
+    record->fields |= PR_FIELD_CHILDREN;
+    field += 10;
+    for (i = 0; i < PR_MAX_CHILDREN && *field >= '0' && *field <= '9'; i++) {
+      record->child_pids[i] = strtol(field, &end, 10);
+      field = *end == ',' ? end + 1 : end;
+    }
+  }
+}
+
+const struct pr_record * PrRecord(const pr_snapshot * snap, unsigned int i) {
+  return (const struct pr_record *) (snap->records + (size_t) i * snap->header.record_size);
+}
+
+int PrReadSnapshot(pr_snapshot * snap) {
+  ssize_t len;
+  int fd;
+
+  PrReleaseSnapshot(snap, 0);
+  fd = OpenReport(PR_BIN_PATH, snap);
+  if (fd < 0)
+    return -1;
+  len = ReadAll(fd, &snap->buffer, &snap->capacity);
+  close(fd);
+  if (len < 0 || CheckHeader((struct pr_header *) snap->buffer, len) < 0)
+    return -1;
+
+  memcpy(&snap->header, snap->buffer, sizeof(snap->header));
+  snap->records = snap->buffer + snap->header.header_size;
+  snap->count = (len - snap->header.header_size) / snap->header.record_size;
+  return 0;
+}
+
+int PrMapSnapshot(pr_snapshot * snap) {
+  long page = sysconf(_SC_PAGESIZE);
+  const struct pr_header * header;
+  void * map;
+  int fd;
+
+  PrReleaseSnapshot(snap, 0);
+  if (snap->map_size == 0)
+    snap->map_size = 16 * page;
+
+  // every mapping is a new snapshot, so a truncated one needs a new open
+  while (1) {
+    fd = OpenReport(PR_BIN_PATH, snap);
+    if (fd < 0)
+      return -1;
+    map = mmap(NULL, snap->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+      return -1;
+
+    header = map;
+    if (CheckHeader(header, snap->map_size) < 0) {
+      munmap(map, snap->map_size);
+      return -1;
+    }
+    if (!(header->flags & PR_FLAG_TRUNCATED))
+      break;
+
+    munmap(map, snap->map_size);
+    if (snap->map_size * 2 > PR_MAP_MAX) {
+      errno = E2BIG;
+      return -1;
+    }
+    snap->map_size *= 2;
+  }
+
+  snap->map = map;
+  memcpy(&snap->header, header, sizeof(snap->header));
+  snap->records = (const char *) map + header->header_size;
+  snap->count = header->count;
+  return 0;
+}
+
+int PrReadText(pr_snapshot * snap) {
+  struct pr_record * record;
+  char * line, * end, * name, * tail;
+  size_t lines = 0, i;
+  ssize_t len;
+  int fd;
+
+  PrReleaseSnapshot(snap, 0);
+  fd = OpenReport(PR_TEXT_PATH, snap);
+  if (fd < 0)
+    return -1;
+  len = ReadAll(fd, &snap->text, &snap->text_capacity);
+  close(fd);
+  if (len < 0)
+    return -1;
+
+  for (i = 0; i < (size_t) len; i++)
+    lines += snap->text[i] == '\n';
+  if (snap->capacity < lines * sizeof(*record)) {
+    snap->capacity = lines * sizeof(*record);
+    snap->buffer = realloc(snap->buffer, snap->capacity);
+    if (snap->buffer == NULL)
+      return -1;
+  }
+
+  memset(&snap->header, 0, sizeof(snap->header));
+  snap->header.magic = PR_MAGIC;
+  snap->header.version = PR_VERSION;
+  snap->header.header_size = sizeof(snap->header);
+  snap->header.record_size = sizeof(*record);
+  snap->records = snap->buffer;
+
+  record = (struct pr_record *) snap->buffer;
+  for (line = snap->text; line < snap->text + len; line = end + 1) {
+    end = memchr(line, '\n', snap->text + len - line);
+    if (end == NULL)
+      end = snap->text + len;
+    *end = '\0';
+
+    if (sscanf(line, "Unrunnable:%u", &snap->header.unrunnable) == 1 ||
+        sscanf(line, "Runnable:%u", &snap->header.runnable) == 1 ||
+        sscanf(line, "Stopped:%u", &snap->header.stopped) == 1 ||
+        strncmp(line, "Process ID=", 11) != 0)
+      continue;
+
+    // a name may hold spaces, so it ends where the known tail starts
+    memset(record, 0, sizeof(*record));
+    record->pid = strtol(line + 11, &name, 10);
+    if (strncmp(name, " Name=", 6) != 0)
+      continue;
+    name += 6;
+    if ((tail = strstr(name, " number_of_children=")) != NULL) {
+      sscanf(tail, " number_of_children=%u first_child=%d", &record->children,
+             &record->first_child);
+    } else if ((tail = strstr(name, " *No Children")) == NULL) {
+      continue;
+    }
+    memcpy(record->comm, name, tail - name < PR_COMM_LEN ? tail - name : PR_COMM_LEN - 1);
+    ParseFields(tail, record);
+    record++;
+  }
+
+  snap->count = record - (struct pr_record *) snap->buffer;
+  return 0;
+}
+
+int PrOpenEvents(int nonblock) {
+  return open(PR_EVENTS_PATH, O_RDONLY | O_CLOEXEC | (nonblock ? O_NONBLOCK : 0));
+}
+
+int PrReadEvents(int fd, struct pr_event * events, int max) {
+  ssize_t n;
+
+  do {
+    n = read(fd, events, max * sizeof(*events));
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    return errno == EAGAIN ? 0 : -1;
+  return n / sizeof(*events);
+}
+
+void PrReleaseSnapshot(pr_snapshot * snap, int final) {
+  if (snap->map != NULL) {
+    munmap(snap->map, snap->map_size);
+    snap->map = NULL;
+  }
+  snap->records = NULL;
+  snap->count = 0;
+
+  if (final) {
+    free(snap->buffer);
+    free(snap->text);
+    snap->buffer = snap->text = NULL;
+    snap->capacity = snap->text_capacity = 0;
+  }
+}
@@ -0,0 +1,60 @@
+/*
+ *  Reader library for the process reporter
+ *
+ *  Reads the report of the procReport module either from the binary
+ *  /proc/proc_report_bin (by read() or by an mmap() snapshot) or, for
+ *  comparison, by parsing the text of /proc/proc_report.  Every way fills
+ *  the same pr_snapshot.
+ */
+
+#ifndef PRLIB_H
+#define PRLIB_H
+
+#include <stddef.h>
+
+#include "proc_report_abi.h"
+
+#define PR_TEXT_PATH "/proc/proc_report"
+#define PR_BIN_PATH "/proc/proc_report_bin"
+#define PR_EVENTS_PATH "/proc/proc_report_events"
+
+typedef struct __pr_snapshot {
+  struct pr_header header;     // copy of the header that was read
+  const char * records;        // first record, step by header.record_size
+  unsigned int count;          // number of records
+  char * buffer;               // read() and text snapshots: the owned data
+  size_t capacity;             // bytes allocated for buffer
+  void * map;                  // mmap() snapshots: the mapping
+  size_t map_size;             // bytes mapped, reused as the next size guess
+  char * text;                 // text snapshots: the text that was parsed
+  size_t text_capacity;        // bytes allocated for text
+  const char * filter;         // written to the report before reading, or NULL
+} pr_snapshot;
+
+// Returns record i of a snapshot
+const struct pr_record * PrRecord(const pr_snapshot * snap, unsigned int i);
+
+// Reads the binary report with read(); returns 0 on success
+int PrReadSnapshot(pr_snapshot * snap);
+
+// Maps a binary snapshot, growing the mapping until nothing is truncated;
+// returns 0 on success
+int PrMapSnapshot(pr_snapshot * snap);
+
+// Reads and parses the text report into binary records (ppid and state
+// are not part of the text and stay 0); returns 0 on success
+int PrReadText(pr_snapshot * snap);
+
+// Opens the event stream, non-blocking if nonblock is set; returns the fd
+// or -1 (EPERM without CAP_SYS_ADMIN, EBUSY while another reader has it)
+int PrOpenEvents(int nonblock);
+
+// Reads up to max events, blocking until there is one unless the stream is
+// non-blocking; returns the number read (0 when none is ready) or -1
+int PrReadEvents(int fd, struct pr_event * events, int max);
+
+// Releases the data of the last snapshot; the buffers are kept for reuse
+// unless final is set
+void PrReleaseSnapshot(pr_snapshot * snap, int final);
+
+#endif
@@ -6,107 +6,424 @@ Process Reporter Kernel Module
 ///////////LIBRARIES///////////////////////
 ///////////////////////////////////////////
 
+#include <linux/binfmts.h>
+#include <linux/capability.h>
 #include <linux/compiler.h>
+#include <linux/irq_work.h>
 #include <linux/klist.h>
 #include <linux/kobject.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/pid.h>
+#include <linux/poll.h>
 #include <linux/proc_fs.h>
 #include <linux/ratelimit.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/tracepoint.h>
 #include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "proc_report_abi.h"
+
+////////////////////////////////////////
+///////////PARAMETERS///////////////////
+////////////////////////////////////////
+
+/*
+  How many processes are visited in one RCU read-side section before it is
+  ended, so that a walk over a busy host never holds one for long.
+*/
+static int chunk = 128;
+module_param(chunk, int, 0644);
+MODULE_PARM_DESC(chunk, "processes visited per RCU read-side section (default 128)");
+
+/*
+  How many events the ring of every CPU holds, rounded up to a power of 2.
+  Takes effect when proc_report_events is opened.
+*/
+static int events = 4096;
+module_param(events, int, 0644);
+MODULE_PARM_DESC(events, "events buffered per CPU for proc_report_events (default 4096)");
+
+/*
+  Every this many seconds the state counters are checked against a walk of
+  every task, to take out the drift of transitions no tracepoint sees.
+*/
+static int resync = 10;
+module_param(resync, int, 0644);
+MODULE_PARM_DESC(resync, "seconds between state counter resyncs, 0 for never (default 10)");
+
+/*
+  How many child pids the text report lists per process when the children
+  field is selected, the binary report lists at most PR_MAX_CHILDREN.
+  Takes effect when the fields are written.
+*/
+static int maxchildren = 64;
+module_param(maxchildren, int, 0644);
+MODULE_PARM_DESC(maxchildren, "child pids listed per process, 1 to 1024 (default 64)");
+
+/*
+  For how many milliseconds one walk of the text report is shared by the
+  readers that want every process and no extra fields, such as 100 when
+  several pollers read at once. A fork, exec or exit ends the sharing
+  early. 0 walks for every read.
+*/
+static int cachems = 0;
+module_param(cachems, int, 0644);
+MODULE_PARM_DESC(cachems, "ms a text report is shared between readers, 0 for never (default 0)");
 
 ////////////////////////////////////////
 ///////////STRUCTURE////////////////////
 ////////////////////////////////////////
 
 /*
-  The structure that represents a process.
+  The processes a reader wants to see, written to the procfile as
+  "root=<pid> states=<RSDTtXZPI letters> prefix=<comm> minchildren=<n>".
+  Fields:
+    active: set once a filter was written.
+    root: only the process with this pid and its descendants (0 for all).
+    states: a mask of task_state_index() bits (0 for all).
+    prefix: only processes whose name starts with this.
+    prefixLen: the length of prefix (0 for all).
+    minChildren: only processes with at least this many children.
+    fields: the PR_FIELD_* bits of the fields to show on top of the usual
+            ones, written as "fields=children,threads,times,rss,ctxsw" or
+            "fields=all"; nothing is computed for the others.
+*/
+typedef struct
+{
+  int active;
+  pid_t root;
+  unsigned int states;
+  char prefix[TASK_COMM_LEN];
+  int prefixLen;
+  int minChildren;
+  unsigned int fields;
+}ChuFilter;
+
+/*
+  The fields of a process that cost more than a look at its task_struct.
+  Fields:
+    threads: the number of threads.
+    utime: the user time of all threads, live and exited, in ns.
+    stime: the system time of all threads, live and exited, in ns.
+    rss: the resident set size in kB.
+    nvcsw: the voluntary context switches of all threads.
+    nivcsw: the involuntary context switches of all threads.
+*/
+typedef struct
+{
+  unsigned int threads;
+  u64 utime, stime;
+  unsigned long rss;
+  unsigned long nvcsw, nivcsw;
+}ChuStats;
+
+/*
+  A text report shared by the readers that want every process and no
+  extra fields.
+  Fields:
+    ref: one reference for reportCache and one for every reader using it.
+    rcu: frees it a grace period after the last reference is put.
+    built: ktime_get_ns() when the walk started.
+    generation: procGeneration when the walk started.
+    len: the bytes of text.
+    text: the report.
+*/
+typedef struct
+{
+  struct kref ref;
+  struct rcu_head rcu;
+  u64 built;
+  unsigned long generation;
+  size_t len;
+  char text[];
+}ChuCache;
+
+/*
+  The state of one reader of the procfile, kept between reads.
+  Fields:
+    pos: the seq_file position of the process in pid.
+    pid: the pid of the process shown at pos, reading resumes from there.
+    held: how many processes were visited in the current RCU section.
+    snapshot: the buffer mapped by the reader of proc_report_bin, or NULL.
+    filter: the processes the reader wants to see.
+    childPids: room for the child pids of one process, once the children
+               field was selected.
+    childMax: how many pids fit in childPids.
+    cache: the shared report this reader is reading, or NULL when it walks.
+    cannotRun: an integer representing how many processes cannot run.
+    canRun: an integer representing how many processes can run.
+    hasStopped: an integer representing how many processes have stopped.
+*/
+typedef struct
+{
+  loff_t pos;
+  pid_t pid;
+  int held;
+  void* snapshot;
+  ChuFilter filter;
+  pid_t* childPids;
+  int childMax;
+  ChuCache* cache;
+  int cannotRun, canRun, hasStopped;
+}ChuIter;
+
+/*
+  Set once the state counters follow every task.
+*/
+static bool statesReady;
+
+/*
+  The states task_state_index() tells apart, in its order: R S D T t X Z P I.
+*/
+#define CHU_STATES 9
+
+/*
+  The change in the number of tasks in every state seen by one CPU.
+  Fields:
+    count: the change for every task_state_index().
+*/
+typedef struct
+{
+  long count[CHU_STATES];
+}StateCounts;
+
+/*
+  The events of one CPU. The tracepoints of that CPU are the only writer
+  and the reader of proc_report_events the only reader, so head and tail
+  are enough to share it without a lock.
   Fields:
-    chuParent: a task structure that points to the parent processes.
-    chuKid: a task structure that points to the child processes.
-    chuChildren: an integer that represents the number of child processes.
+    head: the count of events written, only the writer moves it.
+    tail: the count of events read, only the reader moves it.
+    dropped: the count of events that found the ring full.
+    reported: the count of dropped events the reader was told about.
+    lostAt: the head at the first drop the reader was not told about yet,
+            which is where the events went missing.
+    mask: the number of slots minus one.
+    slots: the events.
 */
-typedef struct 
+typedef struct
 {
-  struct task_struct **chuParent, **chuKid;
-  int chuChildren;
-}ChuProc;
+  unsigned long head;
+  unsigned long tail ____cacheline_aligned;
+  unsigned long dropped;
+  unsigned long reported;
+  unsigned long lostAt;
+  unsigned long mask;
+  struct pr_event slots[];
+}EventRing;
 
 ////////////////////////////////////////
 ///////////PROTOTYPES///////////////////
 ////////////////////////////////////////
 
 /**
-  Writes everything to the procfile.
+  Writes the header of the procfile.
   Parameters:
 	m: the sequence file that is to be used (from seq_file.h).
-	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	howMany: an integer representing how many processes are in theProcesses.
-	cannotRun: an integer representing how many processes are cannot run.
-	canRun: an integer representing how many processes can run.
-	hasStopped: an integer representing how many processes have stopped.
+	iter: the ChuIter holding the counts of the processes.
 */
-void procWrite(struct seq_file* m, ChuProc** theProcesses, int howMany, int cannotRun, 
-	           int canRun, int hasStopped);
+void procWrite(struct seq_file* m, ChuIter* iter);
 
 /**
   Takes a process and prints what's in it on a procfile.
   Parameters:
 	m: the sequence file that is to be used (from seq_file.h).
-	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	i: an integer representing the index on theProcesses.
+	task: the task_struct of the process, the caller holds rcu_read_lock() and
+	  may not use it afterwards.
+	iter: the ChuIter of the reader, for the fields to print.
+*/
+void procPrint(struct seq_file* m, struct task_struct* task, ChuIter* iter);
+
+/**
+  Finds the process with the smallest pid that is not smaller than pid.
+  The caller holds rcu_read_lock(). The pids of threads that are skipped
+  count against chunk, so the section may have been ended and restarted.
+  Parameters:
+	pid: the pid to start looking from.
+	held: the count of the procYield() of the caller.
+  Return:
+	the task_struct of the process, or NULL when there is none.
+*/
+struct task_struct* procFind(pid_t pid, int* held);
+
+/**
+  Finds the first process from pid on that passes the filter of a reader.
+  The caller holds rcu_read_lock().
+  Parameters:
+	iter: the ChuIter of the reader.
+	pid: the pid to start looking from.
+  Return:
+	the task_struct of the process, or NULL when there is none.
+*/
+struct task_struct* procNext(ChuIter* iter, pid_t pid);
+
+/**
+  Tells if a process passes a filter.
+  The caller holds rcu_read_lock().
+  Parameters:
+	filter: the ChuFilter.
+	task: the task_struct of the process.
+  Return:
+	1 if it passes, 0 if not.
+*/
+int procMatch(ChuFilter* filter, struct task_struct* task);
+
+/**
+  Parses a filter.
+  Parameters:
+	filter: the ChuFilter to fill.
+	text: the NUL terminated filter, "clear" or blank for no filter.
+  Return:
+	0, or -EINVAL when the text is not a filter.
+*/
+int procParseFilter(ChuFilter* filter, char* text);
+
+/**
+  Counts the processes by state.
+  Parameters:
+	iter: the ChuIter the counts are written to.
+*/
+void procCount(ChuIter* iter);
+
+/**
+  Ends the RCU read-side section once chunk processes were visited in it,
+  lets the scheduler in and starts a new one. No task_struct found before
+  may be used afterwards, only its pid.
+  Parameters:
+	held: the count of processes visited in the current section.
+*/
+void procYield(int* held);
+
+/**
+  Counts the children of a process and finds the first one, without
+  tasklist_lock. The children list is not RCU protected, so the walk stops
+  at the first entry that moved to another parent or was unlinked, and the
+  result is a best effort snapshot.
+  The caller holds rcu_read_lock().
+  Parameters:
+	task: the task_struct of the process.
+	first: set to the first child, or NULL.
+	pids: filled with the pids of the first max children, or NULL.
+	max: the number of pids that fit in pids.
+  Return:
+	the number of children.
+*/
+int procChildren(struct task_struct* task, struct task_struct** first, pid_t* pids, int max);
+
+/**
+  Computes the selected costly fields of a process.
+  The caller holds rcu_read_lock(). The threads walked count against chunk,
+  so task may not be used afterwards, only its pid.
+  Parameters:
+	task: the task_struct of the process.
+	fields: the PR_FIELD_* bits to compute.
+	stats: the ChuStats to fill, what is not selected stays 0.
+	held: the count of the procYield() of the caller.
+*/
+void procStats(struct task_struct* task, unsigned int fields, ChuStats* stats, int* held);
+
+/**
+  Fills the binary record of a process.
+  The caller holds rcu_read_lock(), task may not be used afterwards.
+  Parameters:
+	task: the task_struct of the process.
+	record: the pr_record to fill.
+	fields: the PR_FIELD_* bits of the extra fields to fill.
+	held: the count of the procYield() of the caller.
+*/
+void procRecord(struct task_struct* task, struct pr_record* record, unsigned int fields,
+                int* held);
+
+/**
+  Writes a pr_header and as many pr_records as fit into a snapshot buffer.
+  Parameters:
+	iter: the ChuIter of the reader, for the counts and the chunking.
+	buffer: the zeroed buffer to write to.
+	size: the size of buffer in bytes.
+*/
+void procSnapshot(ChuIter* iter, void* buffer, size_t size);
+
+/**
+  Gives an upper bound of the number of processes: every task from the
+  state counters, or a walk when there are none.
+  Return:
+	the bound.
+*/
+long procTotal(void);
+
+/**
+  Adds the tasks in every state, from the per-CPU counters.
+  Parameters:
+	counts: filled with the number of tasks in every state.
 */
-void procPrint(struct seq_file* m, ChuProc** theProcesses, int i);
+void procStates(long* counts);
 
 /**
-  Writes everything to the procfile.
+  Walks every process into a new text report.
   Parameters:
-  	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	taskArray: the pointer pointing to the array of tasks.
-	child: the task_struct pointer of the child task.
-	childArray: the list of children list_head pointers.
-	howMany: an integer representing how many processes are in theProcesses.
-	cannotRun: an integer representing how many processes are cannot run.
-	canRun: an integer representing how many processes can run.
-	hasStopped: an integer representing how many processes have stopped.
+	size: the bytes to try first, doubled until the report fits.
+  Return:
+	the ChuCache with one reference, or NULL when out of memory.
+*/
+ChuCache* procCacheBuild(size_t size);
+
+/**
+  Gets a reference to the shared text report, building a new one when it
+  is older than cachems or processes came or went since.
+  Return:
+	the ChuCache, or NULL when none could be built.
 */
-void modifyTaskArray(ChuProc** theProcesses, struct task_struct* taskArray, 
-			         struct task_struct* child, struct list_head* childArray,
-			         int* howMany, int* cannotRun, int* canRun, int* hasStopped);
+ChuCache* procCacheGet(void);
 
 /**
-  Writes everything to the procfile.
+  Puts a reference to a shared text report.
   Parameters:
-  	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	taskArray: the pointer pointing to the array of tasks.
-	howMany: an integer representing how many processes are in theProcesses.
+	cache: the ChuCache, or NULL.
 */
-void newProcess(ChuProc** theProcesses, struct task_struct* taskArray, int howMany);
+void procCachePut(ChuCache* cache);
 
 /**
-  Writes everything to the procfile.
+  Sets the state counters to a walk of every task.
+*/
+void procSeed(void);
+
+/**
+  Adds an event to the ring of the current CPU, from a tracepoint.
   Parameters:
-  	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	taskArray: the pointer pointing to the array of tasks.
-	howMany: an integer representing how many processes are in theProcesses.
-	child: the task_struct pointer of the child task.
+	type: PR_EVENT_FORK, PR_EVENT_EXEC or PR_EVENT_EXIT.
+	task: the task_struct the event is about.
+	ppid: the pid of its parent.
+*/
+void procEventPush(int type, struct task_struct* task, pid_t ppid);
+
+/**
+  Tells if any ring holds an event or a drop to report.
+  Return:
+	1 if the reader has something to read, 0 if not.
 */
-void copyChild(ChuProc** theProcesses, struct task_struct* taskArray, int howMany, 
-			   struct task_struct* child);
+int procEventsPending(void);
 
 /**
-  Writes everything to the procfile.
+  Finds the tracepoints the events come from.
   Parameters:
-	taskArray: the pointer pointing to the array of tasks.
-	cannotRun: an integer representing how many processes are cannot run.
-	canRun: an integer representing how many processes can run.
-	hasStopped: an integer representing how many processes have stopped.
-	howMany: an integer representing how many processes are in theProcesses.
+	tp: a tracepoint of the kernel.
+	priv: unused.
 */
-void incrementVariables(struct task_struct* taskArray, int* cannotRun,int* canRun,
-						int* hasStopped, int* howMany);
+void procFindTracepoint(struct tracepoint* tp, void* priv);
 
 
 ////////////////////////////////////////
@@ -114,237 +431,1767 @@ void incrementVariables(struct task_struct* taskArray, int* cannotRun,int* canRu
 ////////////////////////////////////////
 
 /**
-  Writes everything to the procfile.
+  Writes the header of the procfile.
   Parameters:
 	m: the sequence file that is to be used (from seq_file.h).
-	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	howMany: an integer representing how many processes are in theProcesses.
-	cannotRun: an integer representing how many processes are cannot run.
-	canRun: an integer representing how many processes can run.
-	hasStopped: an integer representing how many processes have stopped.
-*/
-void procWrite(struct seq_file* m, ChuProc** theProcesses, int howMany, int cannotRun, 
-	           int canRun, int hasStopped)
-{  
-  /////////////////////////////////////////////////////////////////
-  int i; //warning: ISO C90 forbids mixed declarations and code ///
-  		 //[-Wdeclaration-after-statement]					    ///
-  /////////////////////////////////////////////////////////////////
-
+	iter: the ChuIter holding the counts of the processes.
+*/
+void procWrite(struct seq_file* m, ChuIter* iter)
+{
   seq_printf(m, "PROCESS REPORTER\nUnrunnable:%d \nRunnable:%d \nStopped:%d\n", 
-  	         cannotRun, canRun, hasStopped);
- 
-  for(i = 0; i < howMany; i++)
-  {
-    procPrint(m, theProcesses, i);
-  }
-
+  	         iter->cannotRun, iter->canRun, iter->hasStopped);
 }
 
 /**
   Takes a process and prints what's in it on a procfile.
   Parameters:
 	m: the sequence file that is to be used (from seq_file.h).
-	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	i: an integer representing the index on theProcesses.
+	task: the task_struct of the process, the caller holds rcu_read_lock() and
+	  may not use it afterwards.
+	iter: the ChuIter of the reader, for the fields to print.
 */
-void procPrint(struct seq_file* m, ChuProc** theProcesses, int i)
+void procPrint(struct seq_file* m, struct task_struct* task, ChuIter* iter)
 {
-	if(theProcesses[i]->chuChildren != 0)
+  unsigned int fields = iter->filter.fields;
+  struct task_struct* child;
+  ChuStats stats;
+  int chuChildren, i;
+
+  chuChildren = procChildren(task, &child, fields & PR_FIELD_CHILDREN ? iter->childPids : NULL,
+                             iter->childMax);
+
+	if(chuChildren != 0)
     {
       seq_printf(m,
-        "Process ID=%d Name=%s number_of_children=%d first_child=%d first_child_name=%s\n", 
-        (*theProcesses[i]->chuParent)->pid, 
-        (*theProcesses[i]->chuParent)->comm, theProcesses[i]->chuChildren, 
-        (*theProcesses[i]->chuKid)->pid, 
-        (*theProcesses[i]->chuKid)->comm);
+        "Process ID=%d Name=%s number_of_children=%d first_child=%d first_child_name=%s", 
+        task->pid, task->comm, chuChildren, child->pid, child->comm);
     }
     else
     {
-      seq_printf(m, "Process ID=%d Name=%s *No Children\n", 
-      			(*theProcesses[i]->chuParent)->pid, 
-      	        (*theProcesses[i]->chuParent)->comm);
+      seq_printf(m, "Process ID=%d Name=%s *No Children", task->pid, task->comm);
     }
-}
-
 
+  //the selected fields follow as key=value pairs
+  procStats(task, fields, &stats, &iter->held);
+  if(fields & PR_FIELD_THREADS)
+    seq_printf(m, " threads=%u", stats.threads);
+  if(fields & PR_FIELD_TIMES)
+    seq_printf(m, " utime_ms=%llu stime_ms=%llu", stats.utime / NSEC_PER_MSEC,
+               stats.stime / NSEC_PER_MSEC);
+  if(fields & PR_FIELD_RSS)
+    seq_printf(m, " rss_kb=%lu", stats.rss);
+  if(fields & PR_FIELD_CTXSW)
+    seq_printf(m, " nvcsw=%lu nivcsw=%lu", stats.nvcsw, stats.nivcsw);
+  if((fields & PR_FIELD_CHILDREN) && chuChildren != 0)
+  {
+    seq_puts(m, " children=");
+    for(i = 0; i < chuChildren && i < iter->childMax; i++)
+      seq_printf(m, i ? ",%d" : "%d", iter->childPids[i]);
+    if(chuChildren > iter->childMax)
+      seq_puts(m, ",...");
+  }
+  seq_putc(m, '\n');
+}
 
 ////////////////////////////////////////////////////////////////////////////
 
 /**
-  Writes everything to the procfile.
+  Finds the process with the smallest pid that is not smaller than pid.
+  The caller holds rcu_read_lock(). The pids of threads that are skipped
+  count against chunk, so the section may have been ended and restarted.
   Parameters:
-  	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	taskArray: the pointer pointing to the array of tasks.
-	child: the task_struct pointer of the child task.
-	childArray: the list of children list_head pointers.
-	howMany: an integer representing how many processes are in theProcesses.
-	cannotRun: an integer representing how many processes are cannot run.
-	canRun: an integer representing how many processes can run.
-	hasStopped: an integer representing how many processes have stopped.
+	pid: the pid to start looking from.
+	held: the count of the procYield() of the caller.
+  Return:
+	the task_struct of the process, or NULL when there is none.
 */
-void modifyTaskArray(ChuProc** theProcesses, struct task_struct* taskArray, 
-			         struct task_struct* child, struct list_head* childArray,
-			         int* howMany, int* cannotRun, int* canRun, int* hasStopped)
+struct task_struct* procFind(pid_t pid, int* held)
 {
-	newProcess(theProcesses, taskArray, *howMany);
+  struct pid* found;
+  struct task_struct* task;
 
-    //If there are children in current process. 
-    list_for_each(childArray, &(taskArray->children))
+  //threads have pids too, only the leaders are processes
+  while((found = find_ge_pid(pid, &init_pid_ns)) != NULL)
+  {
+    task = pid_task(found, PIDTYPE_PID);
+    if(task != NULL && thread_group_leader(task))
     {
-      theProcesses[*howMany]->chuChildren++;
+      return task;
     }
+    pid = pid_nr(found) + 1;
+    procYield(held);
+  }
 
-    copyChild(theProcesses, taskArray, *howMany, child);
-    
-    incrementVariables(taskArray, cannotRun, canRun, hasStopped, howMany);
+  return NULL;
 }
 
 ////////////////////////////////////////////////////////////////////////////
 
 /**
-  Writes everything to the procfile.
+  Finds the first process from pid on that passes the filter of a reader.
+  The caller holds rcu_read_lock().
   Parameters:
-  	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	taskArray: the pointer pointing to the array of tasks.
-	howMany: an integer representing how many processes are in theProcesses.
+	iter: the ChuIter of the reader.
+	pid: the pid to start looking from.
+  Return:
+	the task_struct of the process, or NULL when there is none.
 */
-void newProcess(ChuProc** theProcesses, struct task_struct* taskArray, int howMany)
+struct task_struct* procNext(ChuIter* iter, pid_t pid)
 {
-	//allocate memory for a new process
-    theProcesses = (ChuProc**) krealloc(theProcesses, (howMany + 1) * sizeof(ChuProc*), GFP_KERNEL);
-    theProcesses[howMany] = (ChuProc*) kmalloc(sizeof(ChuProc), GFP_KERNEL);
-    theProcesses[howMany]->chuParent = (struct task_struct**) 
-                                kmalloc(sizeof(struct task_struct), GFP_KERNEL);
-    
-    //copy the content of the process into the array
-    memcpy(theProcesses[howMany]->chuParent, &taskArray, sizeof(struct task_struct));
-    theProcesses[howMany]->chuChildren = 0;
+  struct task_struct* task;
+
+  while((task = procFind(pid, &iter->held)) != NULL && !procMatch(&iter->filter, task))
+  {
+    pid = task->pid + 1;
+    procYield(&iter->held);
+  }
+
+  return task;
 }
 
 ////////////////////////////////////////////////////////////////////////////
 
 /**
-  Writes everything to the procfile.
+  Tells if a process passes a filter.
+  The caller holds rcu_read_lock().
   Parameters:
-  	theProcesses: the double pointer pointing of a list of ChuProc structures.
-	taskArray: the pointer pointing to the array of tasks.
-	howMany: an integer representing how many processes are in theProcesses.
-	child: the task_struct pointer of the child task.
+	filter: the ChuFilter.
+	task: the task_struct of the process.
+  Return:
+	1 if it passes, 0 if not.
 */
-void copyChild(ChuProc** theProcesses, struct task_struct* taskArray, int howMany, 
-			   struct task_struct* child)
+int procMatch(ChuFilter* filter, struct task_struct* task)
 {
-	//Copy first child into array, allocate and copy.
-    if(theProcesses[howMany]->chuChildren)
-    {
-      theProcesses[howMany]->chuKid = (struct task_struct**) 
-                                       kmalloc(sizeof(struct task_struct), GFP_KERNEL);
+  struct task_struct* child;
+  struct task_struct* up;
 
-      child = list_first_entry(&taskArray->children, struct task_struct, sibling);
-      memcpy(theProcesses[howMany]->chuKid, &child, sizeof(struct task_struct));
+  if(!filter->active)
+    return 1;
+
+  //the cheap tests first
+  if(filter->states != 0 && !(filter->states & (1U << task_state_index(task))))
+    return 0;
+  if(filter->prefixLen != 0 && strncmp(task->comm, filter->prefix, filter->prefixLen) != 0)
+    return 0;
+  if(filter->minChildren > 0 && procChildren(task, &child, NULL, 0) < filter->minChildren)
+    return 0;
+
+  if(filter->root != 0)
+  {
+    //init_task (pid 0) is its own parent and ends every chain
+    for(up = task; up->tgid != filter->root; up = rcu_dereference(up->real_parent))
+    {
+      if(up->pid == 0)
+        return 0;
     }
+  }
+
+  return 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////
 
 /**
-  Writes everything to the procfile.
+  Parses a filter.
   Parameters:
-	taskArray: the pointer pointing to the array of tasks.
-	cannotRun: an integer representing how many processes are cannot run.
-	canRun: an integer representing how many processes can run.
-	hasStopped: an integer representing how many processes have stopped.
-	howMany: an integer representing how many processes are in theProcesses.
+	filter: the ChuFilter to fill.
+	text: the NUL terminated filter, "clear" or blank for no filter.
+  Return:
+	0, or -EINVAL when the text is not a filter.
 */
-void incrementVariables(struct task_struct* taskArray, int* cannotRun,int* canRun,
-						int* hasStopped, int* howMany)
+int procParseFilter(ChuFilter* filter, char* text)
 {
-	//howMany processes.
-    if(taskArray->state == -1)
-      (*cannotRun)++;  
-    else if(taskArray->state == 0)
-      (*canRun)++;
+  //in the order of task_state_index()
+  static const char letters[] = "RSDTtXZPI";
+  ChuFilter parsed;
+  char* word;
+  char* value;
+  char* letter;
+
+  memset(&parsed, 0, sizeof(parsed));
+
+  while((word = strsep(&text, " \t\n")) != NULL)
+  {
+    if(*word == '\0' || strcmp(word, "clear") == 0)
+      continue;
+
+    value = strchr(word, '=');
+    if(value == NULL)
+      return -EINVAL;
+    *value++ = '\0';
+    parsed.active |= strcmp(word, "fields") != 0;
+
+    if(strcmp(word, "fields") == 0)
+    {
+      while((letter = strsep(&value, ",")) != NULL)
+      {
+        if(strcmp(letter, "children") == 0)
+          parsed.fields |= PR_FIELD_CHILDREN;
+        else if(strcmp(letter, "threads") == 0)
+          parsed.fields |= PR_FIELD_THREADS;
+        else if(strcmp(letter, "times") == 0)
+          parsed.fields |= PR_FIELD_TIMES;
+        else if(strcmp(letter, "rss") == 0)
+          parsed.fields |= PR_FIELD_RSS;
+        else if(strcmp(letter, "ctxsw") == 0)
+          parsed.fields |= PR_FIELD_CTXSW;
+        else if(strcmp(letter, "all") == 0)
+          parsed.fields |= PR_FIELD_ALL;
+        else if(*letter != '\0')
+          return -EINVAL;
+      }
+    }
+    else if(strcmp(word, "root") == 0)
+    {
+      if(kstrtoint(value, 10, &parsed.root) < 0 || parsed.root < 0)
+        return -EINVAL;
+    }
+    else if(strcmp(word, "states") == 0)
+    {
+      for(; *value != '\0'; value++)
+      {
+        letter = strchr(letters, *value);
+        if(letter == NULL)
+          return -EINVAL;
+        parsed.states |= 1U << (letter - letters);
+      }
+    }
+    else if(strcmp(word, "prefix") == 0)
+    {
+      strscpy(parsed.prefix, value, sizeof(parsed.prefix));
+      parsed.prefixLen = strlen(parsed.prefix);
+    }
+    else if(strcmp(word, "minchildren") == 0)
+    {
+      if(kstrtoint(value, 10, &parsed.minChildren) < 0)
+        return -EINVAL;
+    }
     else
-      (*hasStopped)++;
+    {
+      return -EINVAL;
+    }
+  }
 
-    (*howMany)++;
+  *filter = parsed;
+  return 0;
 }
 
-////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////
 
-/*
-  Take the proecesses and loop through them.
-  Paramters:
-  	m: the seq_file
-  	v: the void pointer
+/**
+  Counts the processes by state.
+  Parameters:
+	iter: the ChuIter the counts are written to.
 */
-static int seeProcReport(struct seq_file* m, void* v)
+void procCount(ChuIter* iter)
 {
-  ChuProc** theProcesses = NULL;
   struct task_struct* taskArray;
-  struct task_struct* child;
-  struct list_head* childArray;
+  unsigned int state;
+  pid_t pid = 1;
+
+  iter->cannotRun = iter->canRun = iter->hasStopped = 0;
+  iter->held = 0;
 
-  int howMany = 0, canRun = 0, hasStopped = 0, cannotRun = 0;
-  for_each_process(taskArray)
+  //in pid order, so the walk can pick up again after every chunk
+  rcu_read_lock();
+  while((taskArray = procNext(iter, pid)) != NULL)
   {
-    modifyTaskArray(theProcesses, taskArray, child, childArray,
-    	            &howMany, &cannotRun, &canRun, &hasStopped);
-  }
+    //R runs, T and t are stopped, S D P I wait; X and Z are gone
+    state = task_state_index(taskArray);
+    if(state == 0)
+      iter->canRun++;
+    else if(state == 3 || state == 4)
+      iter->hasStopped++;
+    else if(state != 5 && state != 6)
+      iter->cannotRun++;
 
-  procWrite(m, theProcesses, howMany, cannotRun, canRun, hasStopped);
-  return 0;
+    pid = taskArray->pid + 1;
+    procYield(&iter->held);
+  }
+  rcu_read_unlock();
 }
 
-////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////
 
 /**
-	Exits the procReport.
+  Ends the RCU read-side section once chunk processes were visited in it,
+  lets the scheduler in and starts a new one. No task_struct found before
+  may be used afterwards, only its pid.
+  Parameters:
+	held: the count of processes visited in the current section.
 */
-static void __exit exitProcReport(void) 
+void procYield(int* held)
 {
-  remove_proc_entry("proc_report", NULL);
+  if(++*held >= chunk)
+  {
+    rcu_read_unlock();
+    cond_resched();
+    rcu_read_lock();
+    *held = 0;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////
+
+/**
+  Counts the children of a process and finds the first one, without
+  tasklist_lock. The children list is not RCU protected, so the walk stops
+  at the first entry that moved to another parent or was unlinked, and the
+  result is a best effort snapshot.
+  The caller holds rcu_read_lock().
+  Parameters:
+	task: the task_struct of the process.
+	first: set to the first child, or NULL.
+	pids: filled with the pids of the first max children, or NULL.
+	max: the number of pids that fit in pids.
+  Return:
+	the number of children.
+*/
+int procChildren(struct task_struct* task, struct task_struct** first, pid_t* pids, int max)
+{
+  struct list_head* childArray = &task->children;
+  struct task_struct* child;
+  int chuChildren = 0;
+
+  *first = NULL;
+
+  //task_structs are freed after a grace period, so the entries stay
+  //readable; a bounded walk keeps a concurrent reparent from trapping us
+  while(chuChildren < PID_MAX_LIMIT)
+  {
+    childArray = READ_ONCE(childArray->next);
+    if(childArray == &task->children)
+    {
+      break;
+    }
+
+    child = list_entry(childArray, struct task_struct, sibling);
+    if(READ_ONCE(childArray->next) == childArray || rcu_access_pointer(child->real_parent) != task)
+    {
+      break;
+    }
+
+    if(chuChildren == 0)
+    {
+      *first = child;
+    }
+    if(pids != NULL && chuChildren < max)
+    {
+      pids[chuChildren] = child->pid;
+    }
+    chuChildren++;
+  }
+
+  return chuChildren;
+}
+
 ////////////////////////////////////////////////////////////////////////////
 
 /**
-	Opens the procReport.
+  Computes the selected costly fields of a process.
+  The caller holds rcu_read_lock(). The threads walked count against chunk,
+  so task may not be used afterwards, only its pid.
+  Parameters:
+	task: the task_struct of the process.
+	fields: the PR_FIELD_* bits to compute.
+	stats: the ChuStats to fill, what is not selected stays 0.
+	held: the count of the procYield() of the caller.
 */
-static int openProcReport(struct inode *inode, struct  file *file) 
+void procStats(struct task_struct* task, unsigned int fields, ChuStats* stats, int* held)
 {
-  
-  return single_open(file, seeProcReport, NULL);
+  struct task_struct* thread;
+  struct mm_struct* mm;
+  int pinned = 0, alive;
+
+  memset(stats, 0, sizeof(*stats));
+
+  if(fields & PR_FIELD_THREADS)
+    stats->threads = get_nr_threads(task);
+
+  if(fields & (PR_FIELD_TIMES | PR_FIELD_CTXSW))
+  {
+    //threads that are gone were added to signal_struct when they exited
+    stats->utime = READ_ONCE(task->signal->utime);
+    stats->stime = READ_ONCE(task->signal->stime);
+    stats->nvcsw = READ_ONCE(task->signal->nvcsw);
+    stats->nivcsw = READ_ONCE(task->signal->nivcsw);
+    for_each_thread(task, thread)
+    {
+      stats->utime += READ_ONCE(thread->utime);
+      stats->stime += READ_ONCE(thread->stime);
+      stats->nvcsw += READ_ONCE(thread->nvcsw);
+      stats->nivcsw += READ_ONCE(thread->nivcsw);
+
+      //like procYield(), but both tasks are pinned over the gap and the
+      //walk only goes on from a thread that is still linked
+      if(++*held < chunk)
+        continue;
+      if(!pinned++)
+        get_task_struct(task);
+      get_task_struct(thread);
+      rcu_read_unlock();
+      cond_resched();
+      rcu_read_lock();
+      *held = 0;
+      alive = pid_alive(thread);
+      put_task_struct(thread);
+      if(!alive)
+        break;
+    }
+  }
+
+  //task_lock keeps the mm from going away under exit or exec
+  if(fields & PR_FIELD_RSS)
+  {
+    task_lock(task);
+    mm = task->mm;
+    if(mm != NULL)
+      stats->rss = get_mm_rss(mm) << (PAGE_SHIFT - 10);
+    task_unlock(task);
+  }
+
+  if(pinned)
+    put_task_struct(task);
 }
 
 ////////////////////////////////////////////////////////////////////////////
+
+/**
+  Fills the binary record of a process.
+  The caller holds rcu_read_lock(), task may not be used afterwards.
+  Parameters:
+	task: the task_struct of the process.
+	record: the pr_record to fill.
+	fields: the PR_FIELD_* bits of the extra fields to fill.
+	held: the count of the procYield() of the caller.
+*/
+void procRecord(struct task_struct* task, struct pr_record* record, unsigned int fields,
+                int* held)
+{
+  struct task_struct* child;
+  ChuStats stats;
+
+  memset(record, 0, sizeof(*record));
+  record->pid = task->pid;
+  record->ppid = rcu_dereference(task->real_parent)->tgid;
+  record->state = (__s32) READ_ONCE(task->state);
+  record->children = procChildren(task, &child,
+                                  fields & PR_FIELD_CHILDREN ? record->child_pids : NULL,
+                                  min(maxchildren, PR_MAX_CHILDREN));
+  record->first_child = child != NULL ? child->pid : 0;
+  strncpy(record->comm, task->comm, PR_COMM_LEN - 1);
+
+  procStats(task, fields, &stats, held);
+  record->fields = fields;
+  record->threads = stats.threads;
+  record->utime_ns = stats.utime;
+  record->stime_ns = stats.stime;
+  record->rss_kb = stats.rss;
+  record->nvcsw = stats.nvcsw;
+  record->nivcsw = stats.nivcsw;
+}
+
 ////////////////////////////////////////////////////////////////////////////
 
 /**
-	The structure that represents the procReport format.
+  Writes a pr_header and as many pr_records as fit into a snapshot buffer.
+  Parameters:
+	iter: the ChuIter of the reader, for the counts and the chunking.
+	buffer: the zeroed buffer to write to.
+	size: the size of buffer in bytes.
 */
-static const struct file_operations procReportF = 
+void procSnapshot(ChuIter* iter, void* buffer, size_t size)
 {
-  .owner = THIS_MODULE,
-  .open = openProcReport,
-  .read = seq_read,
-  .llseek = seq_lseek,
-  .release = single_release,
-};
+  struct pr_header* header = buffer;
+  struct pr_record* record = (struct pr_record*) (header + 1);
+  struct task_struct* task;
+  size_t room = (size - sizeof(*header)) / sizeof(*record);
+  pid_t pid = 1;
+
+  procCount(iter);
+
+  header->magic = PR_MAGIC;
+  header->version = PR_VERSION;
+  header->header_size = sizeof(*header);
+  header->record_size = sizeof(*record);
+  header->flags = PR_FLAG_SNAPSHOT;
+  header->unrunnable = iter->cannotRun;
+  header->runnable = iter->canRun;
+  header->stopped = iter->hasStopped;
+
+  //the buffer was allocated up front, the walk itself never allocates
+  rcu_read_lock();
+  iter->held = 0;
+  while((task = procNext(iter, pid)) != NULL)
+  {
+    if(header->count == room)
+    {
+      header->flags |= PR_FLAG_TRUNCATED;
+      break;
+    }
+
+    pid = task->pid + 1;
+    procRecord(task, &record[header->count++], iter->filter.fields, &iter->held);
+    procYield(&iter->held);
+  }
+  rcu_read_unlock();
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+long procTotal(void)
+{
+  struct task_struct* task;
+  long counts[CHU_STATES], total = 0;
+  int held = 0, i;
+  pid_t pid = 1;
+
+  if(statesReady)
+  {
+    procStates(counts);
+    for(i = 0; i < CHU_STATES; i++)
+      total += counts[i];
+    return total;
+  }
+
+  rcu_read_lock();
+  while((task = procFind(pid, &held)) != NULL)
+  {
+    total++;
+    pid = task->pid + 1;
+    procYield(&held);
+  }
+  rcu_read_unlock();
+  return total;
+}
 
 ////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////
 
-/**
-	Initializing the process report.
+/*
+  Starts or resumes a read of the procfile at pos. Position 0 is the header,
+  the processes follow in pid order.
+  Paramters:
+  	m: the seq_file
+  	pos: the position to start at
 */
-static int __init initializeProcRep(void) 
+static void* startProcReport(struct seq_file* m, loff_t* pos)
 {
-  proc_create("proc_report", 0, NULL, &procReportF);
+  ChuIter* iter = m->private;
+  struct task_struct* task;
+  pid_t pid;
+  loff_t i;
+
+  if(*pos == 0)
+  {
+    procCount(iter);
+    rcu_read_lock();
+    iter->held = 0;
+    return SEQ_START_TOKEN;
+  }
+
+  rcu_read_lock();
+  iter->held = 0;
+
+  //the next read usually carries on where the last one stopped
+  if(*pos == iter->pos)
+  {
+    task = procNext(iter, iter->pid);
+    iter->pid = task != NULL ? task->pid : PID_MAX_LIMIT;
+    return task;
+  }
+
+  //after a seek, count from the first process
+  task = procNext(iter, 1);
+  for(i = 1; task != NULL && i < *pos; i++)
+  {
+    pid = task->pid + 1;
+    procYield(&iter->held);
+    task = procNext(iter, pid);
+  }
+
+  iter->pos = *pos;
+  iter->pid = task != NULL ? task->pid : PID_MAX_LIMIT;
+  return task;
+}
+
+/*
+  Moves to the process after v.
+  Paramters:
+  	m: the seq_file
+  	v: the process that was just shown, or the header
+  	pos: the position of v, moved to the next one
+*/
+static void* nextProcReport(struct seq_file* m, void* v, loff_t* pos)
+{
+  ChuIter* iter = m->private;
+  struct task_struct* task;
+  pid_t pid = v == SEQ_START_TOKEN ? 1 : iter->pid + 1;
+
+  //v may be gone already, showing it can end the section; iter->pid is its pid
+  procYield(&iter->held);
+  task = procNext(iter, pid);
+
+  ++*pos;
+  iter->pos = *pos;
+  iter->pid = task != NULL ? task->pid : PID_MAX_LIMIT;
+  return task;
+}
+
+/*
+  Ends a read of the procfile.
+  Paramters:
+  	m: the seq_file
+  	v: the last process returned by startProcReport() or nextProcReport()
+*/
+static void stopProcReport(struct seq_file* m, void* v)
+{
+  rcu_read_unlock();
+}
+
+/*
+  Shows the header or one process.
+  Paramters:
+  	m: the seq_file
+  	v: the process to show, or SEQ_START_TOKEN for the header
+*/
+static int seeProcReport(struct seq_file* m, void* v)
+{
+  if(v == SEQ_START_TOKEN)
+  {
+    procWrite(m, m->private);
+  }
+  else
+  {
+    procPrint(m, v, m->private);
+  }
+  return 0;
+}
+
+/*
+  Shows the binary header or the binary record of one process.
+  Paramters:
+  	m: the seq_file
+  	v: the process to show, or SEQ_START_TOKEN for the header
+*/
+static int seeProcReportBin(struct seq_file* m, void* v)
+{
+  ChuIter* iter = m->private;
+  struct pr_header header;
+  struct pr_record record;
+
+  if(v == SEQ_START_TOKEN)
+  {
+    memset(&header, 0, sizeof(header));
+    header.magic = PR_MAGIC;
+    header.version = PR_VERSION;
+    header.header_size = sizeof(header);
+    header.record_size = sizeof(record);
+    header.unrunnable = iter->cannotRun;
+    header.runnable = iter->canRun;
+    header.stopped = iter->hasStopped;
+    seq_write(m, &header, sizeof(header));
+  }
+  else
+  {
+    procRecord(v, &record, iter->filter.fields, &iter->held);
+    seq_write(m, &record, sizeof(record));
+  }
+  return 0;
+}
+
+/**
+	The iterator the procfile is read with.
+*/
+static const struct seq_operations procReportOps =
+{
+  .start = startProcReport,
+  .next = nextProcReport,
+  .stop = stopProcReport,
+  .show = seeProcReport,
+};
+
+/**
+	The iterator the binary procfile is read with.
+*/
+static const struct seq_operations procReportBinOps =
+{
+  .start = startProcReport,
+  .next = nextProcReport,
+  .stop = stopProcReport,
+  .show = seeProcReportBin,
+};
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/*
+  The state counters: the tasks in every state are stateBase plus the sum of
+  stateCounts over all CPUs. stateBase is set by procSeed().
+*/
+static DEFINE_PER_CPU(StateCounts, stateCounts);
+static long stateBase[CHU_STATES];
+static DEFINE_SPINLOCK(stateLock);
+static struct tracepoint* switchPoint;
+static struct tracepoint* wakingPoint;
+static struct tracepoint* wakeupNewPoint;
+static struct tracepoint* freePoint;
+static void resyncStates(struct work_struct* work);
+static DECLARE_DELAYED_WORK(stateWork, resyncStates);
+
+/*
+  Moves a task that goes to sleep, stops or dies out of R. A task that was
+  preempted or still has to run stays on the runqueue and in R.
+*/
+static void switchProbe(void* data, bool preempt, struct task_struct* prev,
+                        struct task_struct* next)
+{
+  unsigned int state;
+
+  if(preempt || READ_ONCE(prev->on_rq))
+    return;
+
+  //exited tasks stay in Z until they are freed, reaping has no tracepoint
+  state = task_state_index(prev);
+  if(state == 5)
+    state = 6;
+  if(state != 0)
+  {
+    this_cpu_dec(stateCounts.count[0]);
+    this_cpu_inc(stateCounts.count[state]);
+  }
+}
+
+/*
+  Moves a task that is woken back to R, from the state it slept in.
+*/
+static void wakingProbe(void* data, struct task_struct* task)
+{
+  unsigned int state;
+
+  //still on the runqueue: it never left R
+  if(READ_ONCE(task->on_rq))
+    return;
+
+  state = task_state_index(task);
+  if(state != 0)
+  {
+    this_cpu_dec(stateCounts.count[state]);
+    this_cpu_inc(stateCounts.count[0]);
+  }
+}
+
+/*
+  Counts a new task, it starts in R.
+*/
+static void wakeupNewProbe(void* data, struct task_struct* task)
+{
+  this_cpu_inc(stateCounts.count[0]);
+}
+
+/*
+  Stops counting a task that was freed.
+*/
+static void freeProbe(void* data, struct task_struct* task)
+{
+  this_cpu_dec(stateCounts.count[6]);
+}
+
+/**
+  Adds the tasks in every state, from the per-CPU counters.
+  Parameters:
+	counts: filled with the number of tasks in every state.
+*/
+void procStates(long* counts)
+{
+  StateCounts* cpuCounts;
+  int cpu, i;
+
+  spin_lock(&stateLock);
+  for(i = 0; i < CHU_STATES; i++)
+    counts[i] = stateBase[i];
+  for_each_possible_cpu(cpu)
+  {
+    cpuCounts = per_cpu_ptr(&stateCounts, cpu);
+    for(i = 0; i < CHU_STATES; i++)
+      counts[i] += READ_ONCE(cpuCounts->count[i]);
+  }
+  spin_unlock(&stateLock);
+
+  //a transition may be half seen while the sums are taken
+  for(i = 0; i < CHU_STATES; i++)
+  {
+    if(counts[i] < 0)
+      counts[i] = 0;
+  }
+}
+
+/**
+  Sets the state counters to a walk of every task.
+*/
+void procSeed(void)
+{
+  long walked[CHU_STATES] = { 0 };
+  long deltas[CHU_STATES] = { 0 };
+  struct task_struct* task;
+  struct pid* found;
+  unsigned int state;
+  int held = 0, cpu, i;
+  pid_t pid = 1;
+
+  //every pid in order, threads included, in chunks like the report
+  rcu_read_lock();
+  while((found = find_ge_pid(pid, &init_pid_ns)) != NULL)
+  {
+    task = pid_task(found, PIDTYPE_PID);
+    if(task != NULL)
+    {
+      state = task_state_index(task);
+      walked[state == 5 ? 6 : state]++;
+    }
+    pid = pid_nr(found) + 1;
+    procYield(&held);
+  }
+  rcu_read_unlock();
+
+  //the per-CPU deltas keep going, the base moves to where the walk was
+  spin_lock(&stateLock);
+  for_each_possible_cpu(cpu)
+  {
+    for(i = 0; i < CHU_STATES; i++)
+      deltas[i] += READ_ONCE(per_cpu_ptr(&stateCounts, cpu)->count[i]);
+  }
+  for(i = 0; i < CHU_STATES; i++)
+    stateBase[i] = walked[i] - deltas[i];
+  spin_unlock(&stateLock);
+}
+
+/*
+  Resyncs the state counters every resync seconds.
+*/
+static void resyncStates(struct work_struct* work)
+{
+  procSeed();
+  if(resync > 0)
+    schedule_delayed_work(&stateWork, resync * HZ);
+}
+
+/*
+  Shows every state count. Unlike the header of the report, which counts
+  processes, the counters count every task, threads included.
+*/
+static int seeProcSummary(struct seq_file* m, void* v)
+{
+  static const char* names[CHU_STATES] =
+  {
+    "running", "sleeping", "disk sleep", "stopped", "tracing stop", "dead", "zombie",
+    "parked", "idle"
+  };
+  static const char letters[] = "RSDTtXZPI";
+  long counts[CHU_STATES], total = 0;
+  int i;
+
+  procStates(counts);
+  seq_puts(m, "TASK SUMMARY (threads included)\n");
+  for(i = 0; i < CHU_STATES; i++)
+  {
+    seq_printf(m, "%c %s:%ld\n", letters[i], names[i], counts[i]);
+    total += counts[i];
+  }
+  seq_printf(m, "Total tasks:%ld\n", total);
+  return 0;
+}
+
+/**
+	Opens the summary.
+*/
+static int openProcSummary(struct inode *inode, struct  file *file) 
+{
+  return single_open(file, seeProcSummary, NULL);
+}
+
+/**
+	The structure that represents the summary.
+*/
+static const struct file_operations procSummaryF = 
+{
+  .owner = THIS_MODULE,
+  .open = openProcSummary,
+  .read = seq_read,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/*
+  The event rings of every CPU, the tracepoints they are filled from and
+  the reader waiting for them.
+*/
+static DEFINE_PER_CPU(EventRing*, eventRings);
+static struct tracepoint* forkPoint;
+static struct tracepoint* execPoint;
+static struct tracepoint* exitPoint;
+static DECLARE_WAIT_QUEUE_HEAD(eventWait);
+static struct irq_work eventWork;
+static atomic_t eventReaders = ATOMIC_INIT(0);
+static DEFINE_MUTEX(eventLock);
+
+/**
+  Adds an event to the ring of the current CPU, from a tracepoint.
+  Parameters:
+	type: PR_EVENT_FORK, PR_EVENT_EXEC or PR_EVENT_EXIT.
+	task: the task_struct the event is about.
+	ppid: the pid of its parent.
+*/
+void procEventPush(int type, struct task_struct* task, pid_t ppid)
+{
+  //tracepoints run with preemption off, so the CPU cannot change
+  EventRing* ring = __this_cpu_read(eventRings);
+  struct pr_event* event;
+  unsigned long head;
+
+  if(ring == NULL)
+    return;
+
+  head = ring->head;
+  if(head - smp_load_acquire(&ring->tail) > ring->mask)
+  {
+    //the reader finds lostAt once it sees dropped move
+    if(ring->dropped == READ_ONCE(ring->reported))
+      WRITE_ONCE(ring->lostAt, head);
+    smp_store_release(&ring->dropped, ring->dropped + 1);
+    return;
+  }
+
+  event = &ring->slots[head & ring->mask];
+  event->type = type;
+  event->cpu = smp_processor_id();
+  event->pid = task->pid;
+  event->ppid = ppid;
+  event->lost = 0;
+  event->time_ns = ktime_get_ns();
+  memcpy(event->comm, task->comm, PR_COMM_LEN);
+  event->comm[PR_COMM_LEN - 1] = '\0';
+  smp_store_release(&ring->head, head + 1);
+
+  //a reader only sleeps on empty rings, so only the first event wakes it;
+  //waking from here could take scheduler locks, irq_work defers it
+  smp_mb();
+  if(READ_ONCE(ring->tail) == head)
+    irq_work_queue(&eventWork);
+}
+
+/*
+  Records a new process.
+*/
+static void forkProbe(void* data, struct task_struct* parent, struct task_struct* child)
+{
+  if(thread_group_leader(child))
+    procEventPush(PR_EVENT_FORK, child, parent->tgid);
+}
+
+/*
+  Records a process running a new program.
+*/
+static void execProbe(void* data, struct task_struct* task, pid_t oldPid,
+                      struct linux_binprm* bprm)
+{
+  procEventPush(PR_EVENT_EXEC, task, task_ppid_nr(task));
+}
+
+/*
+  Records a process that exits.
+*/
+static void exitProbe(void* data, struct task_struct* task)
+{
+  if(thread_group_leader(task))
+    procEventPush(PR_EVENT_EXIT, task, task_ppid_nr(task));
+}
+
+/*
+  Wakes the reader, outside of the tracepoint.
+*/
+static void wakeProcEvents(struct irq_work* work)
+{
+  wake_up_interruptible(&eventWait);
+}
+
+/**
+  Tells if any ring holds an event or a drop to report.
+  Return:
+	1 if the reader has something to read, 0 if not.
+*/
+int procEventsPending(void)
+{
+  EventRing* ring;
+  int cpu;
+
+  for_each_possible_cpu(cpu)
+  {
+    ring = per_cpu(eventRings, cpu);
+    if(ring != NULL && (smp_load_acquire(&ring->head) != ring->tail ||
+                        READ_ONCE(ring->dropped) != ring->reported))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+  Finds the tracepoints the events come from.
+  Parameters:
+	tp: a tracepoint of the kernel.
+	priv: unused.
+*/
+void procFindTracepoint(struct tracepoint* tp, void* priv)
+{
+  if(strcmp(tp->name, "sched_process_fork") == 0)
+    forkPoint = tp;
+  else if(strcmp(tp->name, "sched_process_exec") == 0)
+    execPoint = tp;
+  else if(strcmp(tp->name, "sched_process_exit") == 0)
+    exitPoint = tp;
+  else if(strcmp(tp->name, "sched_switch") == 0)
+    switchPoint = tp;
+  else if(strcmp(tp->name, "sched_waking") == 0)
+    wakingPoint = tp;
+  else if(strcmp(tp->name, "sched_wakeup_new") == 0)
+    wakeupNewPoint = tp;
+  else if(strcmp(tp->name, "sched_process_free") == 0)
+    freePoint = tp;
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Stops the events and frees the rings.
+*/
+static void closeProcEvents(void) 
+{
+  EventRing* ring;
+  int cpu;
+
+  if(forkPoint != NULL)
+    tracepoint_probe_unregister(forkPoint, forkProbe, NULL);
+  if(execPoint != NULL)
+    tracepoint_probe_unregister(execPoint, execProbe, NULL);
+  if(exitPoint != NULL)
+    tracepoint_probe_unregister(exitPoint, exitProbe, NULL);
+
+  //no probe runs any more once this returns
+  tracepoint_synchronize_unregister();
+  irq_work_sync(&eventWork);
+
+  for_each_possible_cpu(cpu)
+  {
+    ring = per_cpu(eventRings, cpu);
+    per_cpu(eventRings, cpu) = NULL;
+    kvfree(ring);
+  }
+}
+
+/**
+	Opens the event stream, there is one reader at a time. Only an
+	administrator may hold it, so that no user can lock the monitor out.
+*/
+static int openProcEvents(struct inode *inode, struct  file *file) 
+{
+  unsigned long slots = roundup_pow_of_two(clamp(events, 64, 1 << 20));
+  EventRing* ring;
+  int cpu, error = 0;
+
+  if(file->f_mode & FMODE_WRITE)
+    return -EINVAL;
+  if(!capable(CAP_SYS_ADMIN))
+    return -EPERM;
+  if(atomic_cmpxchg(&eventReaders, 0, 1) != 0)
+    return -EBUSY;
+
+  for_each_possible_cpu(cpu)
+  {
+    ring = kvzalloc(sizeof(EventRing) + slots * sizeof(struct pr_event), GFP_KERNEL);
+    if(ring == NULL)
+    {
+      error = -ENOMEM;
+      goto fail;
+    }
+    ring->mask = slots - 1;
+    per_cpu(eventRings, cpu) = ring;
+  }
+
+  if(forkPoint == NULL || execPoint == NULL || exitPoint == NULL)
+  {
+    error = -ENOSYS;
+    goto fail;
+  }
+  if((error = tracepoint_probe_register(forkPoint, forkProbe, NULL)) < 0 ||
+     (error = tracepoint_probe_register(execPoint, execProbe, NULL)) < 0 ||
+     (error = tracepoint_probe_register(exitPoint, exitProbe, NULL)) < 0)
+    goto fail;
+
+  return nonseekable_open(inode, file);
+
+fail:
+  closeProcEvents();
+  atomic_set(&eventReaders, 0);
+  return error;
+}
+
+/**
+	Copies the events of a ring from *tail up to stop, as far as they fit.
+	Parameters:
+	ring: the EventRing of one CPU.
+	buffer: the buffer of the reader.
+	count: the size of buffer.
+	done: the bytes of buffer already used, moved on past the events.
+	tail: the first event to copy, moved on past the events.
+	stop: the event to stop at.
+	Return:
+	0, or -EFAULT if buffer could not be written.
+*/
+static int procCopyEvents(EventRing* ring, char __user* buffer, size_t count, size_t* done,
+                          unsigned long* tail, unsigned long stop)
+{
+  for(; *tail != stop && count - *done >= sizeof(struct pr_event); ++*tail)
+  {
+    if(copy_to_user(buffer + *done, &ring->slots[*tail & ring->mask], sizeof(struct pr_event)))
+      return -EFAULT;
+    *done += sizeof(struct pr_event);
+  }
+  return 0;
+}
+
+/**
+	Copies whole events to the reader, one CPU after the other. A CPU that
+	dropped events reports a PR_EVENT_LOST record after the events it had
+	before the drop, where the gap is. Blocks while there is nothing to
+	read, unless O_NONBLOCK is set. Threads and children sharing the file
+	take turns, the tails are the reader's own.
+*/
+static ssize_t readProcEvents(struct file *file, char __user *buffer, size_t count,
+                              loff_t *ppos) 
+{
+  struct pr_event lost;
+  EventRing* ring;
+  unsigned long head, tail, stop, dropped;
+  size_t done = 0;
+  int cpu, error = 0;
+
+  if(count < sizeof(struct pr_event))
+    return -EINVAL;
+
+  while(1)
+  {
+    if(mutex_lock_interruptible(&eventLock))
+      return -ERESTARTSYS;
+
+    for_each_possible_cpu(cpu)
+    {
+      ring = per_cpu(eventRings, cpu);
+
+      //the slots up to head are ours until tail moves past them; with a
+      //drop, the ones up to lostAt came before it (a lostAt the reader
+      //already passed means the drop was right where it stands)
+      dropped = smp_load_acquire(&ring->dropped);
+      head = smp_load_acquire(&ring->head);
+      tail = ring->tail;
+      stop = head;
+      if(dropped != ring->reported)
+      {
+        stop = READ_ONCE(ring->lostAt);
+        if((long) (stop - tail) < 0 || (long) (head - stop) < 0)
+          stop = tail;
+      }
+
+      error = procCopyEvents(ring, buffer, count, &done, &tail, stop);
+      if(error == 0 && tail == stop && dropped != ring->reported &&
+         count - done >= sizeof(lost))
+      {
+        memset(&lost, 0, sizeof(lost));
+        lost.type = PR_EVENT_LOST;
+        lost.cpu = cpu;
+        lost.lost = dropped - ring->reported;
+        lost.time_ns = ktime_get_ns();
+        if(copy_to_user(buffer + done, &lost, sizeof(lost)))
+        {
+          error = -EFAULT;
+        }
+        else
+        {
+          WRITE_ONCE(ring->reported, dropped);
+          done += sizeof(lost);
+          error = procCopyEvents(ring, buffer, count, &done, &tail, head);
+        }
+      }
+      smp_store_release(&ring->tail, tail);
+      if(error < 0)
+        break;
+    }
+
+    mutex_unlock(&eventLock);
+
+    if(done != 0)
+      return done;
+    if(error < 0)
+      return error;
+    if(file->f_flags & O_NONBLOCK)
+      return -EAGAIN;
+
+    error = wait_event_interruptible(eventWait, procEventsPending());
+    if(error < 0)
+      return error;
+  }
+}
+
+/**
+	Tells poll() and epoll if there are events to read.
+*/
+static __poll_t pollProcEvents(struct file *file, poll_table *wait) 
+{
+  poll_wait(file, &eventWait, wait);
+  return procEventsPending() ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+/**
+	Closes the event stream.
+*/
+static int releaseProcEvents(struct inode *inode, struct  file *file) 
+{
+  closeProcEvents();
+  atomic_set(&eventReaders, 0);
+  return 0;
+}
+
+/**
+	The structure that represents the event stream.
+*/
+static const struct file_operations procEventsF = 
+{
+  .owner = THIS_MODULE,
+  .open = openProcEvents,
+  .read = readProcEvents,
+  .poll = pollProcEvents,
+  .llseek = no_llseek,
+  .release = releaseProcEvents,
+};
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/*
+  The shared text report, replaced under cacheLock and read under RCU, and
+  the generation the lifecycle tracepoints move on. generationReady is set
+  once all three are followed; the report is not shared without them.
+*/
+static ChuCache __rcu* reportCache;
+static DEFINE_MUTEX(cacheLock);
+static atomic_long_t procGeneration = ATOMIC_LONG_INIT(0);
+static bool generationReady;
+
+/*
+  Ends the sharing of the report on a new process.
+*/
+static void forkGenerationProbe(void* data, struct task_struct* parent, struct task_struct* child)
+{
+  if(thread_group_leader(child))
+    atomic_long_inc(&procGeneration);
+}
+
+/*
+  Ends the sharing of the report on a process with a new name.
+*/
+static void execGenerationProbe(void* data, struct task_struct* task, pid_t oldPid,
+                                struct linux_binprm* bprm)
+{
+  atomic_long_inc(&procGeneration);
+}
+
+/*
+  Ends the sharing of the report on a process that exits.
+*/
+static void exitGenerationProbe(void* data, struct task_struct* task)
+{
+  if(thread_group_leader(task))
+    atomic_long_inc(&procGeneration);
+}
+
+/**
+  Walks every process into a new text report.
+  Parameters:
+	size: the bytes to try first, doubled until the report fits.
+  Return:
+	the ChuCache with one reference, or NULL when out of memory.
+*/
+ChuCache* procCacheBuild(size_t size)
+{
+  struct task_struct* task;
+  struct seq_file m;
+  ChuCache* cache;
+  ChuIter iter;
+  pid_t pid;
+
+  while(size <= PR_MAP_MAX)
+  {
+    cache = kvmalloc(sizeof(ChuCache) + size, GFP_KERNEL);
+    if(cache == NULL)
+      return NULL;
+
+    //a change during the walk leaves the report stale, not the next one
+    cache->built = ktime_get_ns();
+    cache->generation = atomic_long_read(&procGeneration);
+
+    //procWrite() and procPrint() only need the buffer of a seq_file
+    memset(&m, 0, sizeof(m));
+    m.buf = cache->text;
+    m.size = size;
+    memset(&iter, 0, sizeof(iter));
+
+    procCount(&iter);
+    procWrite(&m, &iter);
+    rcu_read_lock();
+    iter.held = 0;
+    pid = 1;
+    while((task = procNext(&iter, pid)) != NULL && !seq_has_overflowed(&m))
+    {
+      pid = task->pid + 1;
+      procPrint(&m, task, &iter);
+      procYield(&iter.held);
+    }
+    rcu_read_unlock();
+
+    if(!seq_has_overflowed(&m))
+    {
+      kref_init(&cache->ref);
+      cache->len = m.count;
+      return cache;
+    }
+    kvfree(cache);
+    size *= 2;
+  }
+
+  return NULL;
+}
+
+/*
+  Frees a shared text report once no reader can still be finding it.
+*/
+static void freeCache(struct rcu_head* rcu)
+{
+  kvfree(container_of(rcu, ChuCache, rcu));
+}
+
+/*
+  Frees a shared text report after its last reference.
+*/
+static void releaseCache(struct kref* ref)
+{
+  //a reader that loaded reportCache before it was replaced may still
+  //try to take a reference
+  call_rcu(&container_of(ref, ChuCache, ref)->rcu, freeCache);
+}
+
+/**
+  Tells if a shared text report can still be used.
+  Parameters:
+	cache: the ChuCache.
+	now: ktime_get_ns().
+  Return:
+	1 if it is fresh, 0 if not.
+*/
+static int procCacheFresh(ChuCache* cache, u64 now)
+{
+  return now - cache->built < (u64) cachems * NSEC_PER_MSEC &&
+         cache->generation == atomic_long_read(&procGeneration);
+}
+
+/**
+  Gets a reference to the shared text report, building a new one when it
+  is older than cachems or processes came or went since.
+  Return:
+	the ChuCache, or NULL when none could be built.
+*/
+ChuCache* procCacheGet(void)
+{
+  u64 asked = ktime_get_ns();
+  ChuCache* cache;
+  ChuCache* old;
+
+  rcu_read_lock();
+  cache = rcu_dereference(reportCache);
+  if(cache != NULL && procCacheFresh(cache, asked) && kref_get_unless_zero(&cache->ref))
+  {
+    rcu_read_unlock();
+    return cache;
+  }
+  rcu_read_unlock();
+
+  //one reader walks, the others wait for its report; a walk that started
+  //after we asked is as good as our own, whatever changed during it
+  mutex_lock(&cacheLock);
+  old = rcu_dereference_protected(reportCache, lockdep_is_held(&cacheLock));
+  if(old != NULL && (old->built >= asked || procCacheFresh(old, ktime_get_ns())))
+  {
+    kref_get(&old->ref);
+    mutex_unlock(&cacheLock);
+    return old;
+  }
+
+  cache = procCacheBuild(old != NULL ? old->len + old->len / 4 : 16 * PAGE_SIZE);
+  if(cache == NULL)
+  {
+    mutex_unlock(&cacheLock);
+    return NULL;
+  }
+  kref_get(&cache->ref);
+  rcu_assign_pointer(reportCache, cache);
+  mutex_unlock(&cacheLock);
+
+  procCachePut(old);
+  return cache;
+}
+
+/**
+  Puts a reference to a shared text report.
+  Parameters:
+	cache: the ChuCache, or NULL.
+*/
+void procCachePut(ChuCache* cache)
+{
+  if(cache != NULL)
+    kref_put(&cache->ref, releaseCache);
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Exits the procReport.
+*/
+static void __exit exitProcReport(void) 
+{
+  ChuCache* old;
+
+  if(statesReady)
+  {
+    cancel_delayed_work_sync(&stateWork);
+    tracepoint_probe_unregister(switchPoint, switchProbe, NULL);
+    tracepoint_probe_unregister(wakingPoint, wakingProbe, NULL);
+    tracepoint_probe_unregister(wakeupNewPoint, wakeupNewProbe, NULL);
+    tracepoint_probe_unregister(freePoint, freeProbe, NULL);
+    tracepoint_synchronize_unregister();
+    remove_proc_entry("proc_report_summary", NULL);
+  }
+
+  remove_proc_entry("proc_report_events", NULL);
+  remove_proc_entry("proc_report_bin", NULL);
+  remove_proc_entry("proc_report", NULL);
+
+  if(generationReady)
+  {
+    tracepoint_probe_unregister(forkPoint, forkGenerationProbe, NULL);
+    tracepoint_probe_unregister(execPoint, execGenerationProbe, NULL);
+    tracepoint_probe_unregister(exitPoint, exitGenerationProbe, NULL);
+    tracepoint_synchronize_unregister();
+  }
+
+  //every reader is gone, only reportCache holds the last report
+  old = rcu_dereference_protected(reportCache, 1);
+  RCU_INIT_POINTER(reportCache, NULL);
+  procCachePut(old);
+  rcu_barrier();
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Opens the procReport.
+*/
+static int openProcReport(struct inode *inode, struct  file *file) 
+{
+  
+  return seq_open_private(file, &procReportOps, sizeof(ChuIter));
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Reads the procReport. A reader without a filter or fields gets the
+	shared report when cachems is set and the lifecycle tracepoints are
+	followed, the others walk through seq_read().
+	Every read from position 0 decides again.
+*/
+static ssize_t readProcReport(struct file *file, char __user *buffer, size_t count,
+                              loff_t *ppos) 
+{
+  struct seq_file* m = file->private_data;
+  ChuIter* iter = m->private;
+  ssize_t done;
+
+  mutex_lock(&m->lock);
+  if(*ppos == 0)
+  {
+    procCachePut(iter->cache);
+    iter->cache = NULL;
+    if(cachems > 0 && generationReady && !iter->filter.active && iter->filter.fields == 0)
+      iter->cache = procCacheGet();
+  }
+
+  if(iter->cache == NULL)
+  {
+    mutex_unlock(&m->lock);
+    return seq_read(file, buffer, count, ppos);
+  }
+
+  done = simple_read_from_buffer(buffer, count, ppos, iter->cache->text, iter->cache->len);
+  mutex_unlock(&m->lock);
+  return done;
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Seeks in the procReport, within the shared report when it is read.
+*/
+static loff_t seekProcReport(struct file *file, loff_t offset, int whence) 
+{
+  struct seq_file* m = file->private_data;
+  ChuIter* iter = m->private;
+  loff_t pos;
+
+  mutex_lock(&m->lock);
+  if(iter->cache == NULL)
+  {
+    mutex_unlock(&m->lock);
+    return seq_lseek(file, offset, whence);
+  }
+
+  pos = fixed_size_llseek(file, offset, whence, iter->cache->len);
+  mutex_unlock(&m->lock);
+  return pos;
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Opens the binary procReport.
+*/
+static int openProcReportBin(struct inode *inode, struct  file *file) 
+{
+  return seq_open_private(file, &procReportBinOps, sizeof(ChuIter));
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Sets the filter of the reader, it applies from the next read at
+	position 0 on (lseek() back to 0 after writing).
+*/
+static ssize_t writeProcReport(struct file *file, const char __user *buffer, size_t count,
+                               loff_t *ppos) 
+{
+  struct seq_file* m = file->private_data;
+  ChuIter* iter = m->private;
+  char text[256];
+  int error;
+
+  if(count >= sizeof(text))
+    return -EINVAL;
+  if(copy_from_user(text, buffer, count))
+    return -EFAULT;
+  text[count] = '\0';
+
+  mutex_lock(&m->lock);
+  error = procParseFilter(&iter->filter, text);
+  //the old position and report belong to the old filter
+  iter->pos = 0;
+  procCachePut(iter->cache);
+  iter->cache = NULL;
+
+  //the room for child pids is made here, never during a walk
+  if(error == 0 && (iter->filter.fields & PR_FIELD_CHILDREN) &&
+     iter->childMax != clamp(maxchildren, 1, 1024))
+  {
+    kfree(iter->childPids);
+    iter->childMax = clamp(maxchildren, 1, 1024);
+    iter->childPids = kmalloc_array(iter->childMax, sizeof(pid_t), GFP_KERNEL);
+    if(iter->childPids == NULL)
+    {
+      iter->childMax = 0;
+      iter->filter.fields &= ~PR_FIELD_CHILDREN;
+      error = -ENOMEM;
+    }
+  }
+  mutex_unlock(&m->lock);
+
+  return error < 0 ? error : count;
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Maps a snapshot of the binary procReport, as big as the mapping. Every
+	open file has at most one snapshot, it is freed when the file is.
+*/
+static int mapProcReport(struct file *file, struct vm_area_struct *vma) 
+{
+  struct seq_file* m = file->private_data;
+  ChuIter* iter = m->private;
+  unsigned long size = vma->vm_end - vma->vm_start;
+  unsigned long need;
+  int error;
+
+  if(vma->vm_pgoff != 0 || size < PAGE_SIZE || size > PR_MAP_MAX)
+    return -EINVAL;
+  if(vma->vm_flags & VM_WRITE)
+    return -EPERM;
+
+  //the snapshot is kernel memory pinned for as long as the map lives, so a
+  //reader gets at most twice what every process (and some more) needs,
+  //where doubling from a small map stops; 16 pages are always fine
+  need = sizeof(struct pr_header) + (procTotal() + 64) * sizeof(struct pr_record);
+  if(size > max(2 * need, 16 * PAGE_SIZE))
+    return -EINVAL;
+
+  mutex_lock(&m->lock);
+  if(iter->snapshot != NULL)
+  {
+    mutex_unlock(&m->lock);
+    return -EBUSY;
+  }
+
+  iter->snapshot = vmalloc_user(size);
+  if(iter->snapshot == NULL)
+  {
+    mutex_unlock(&m->lock);
+    return -ENOMEM;
+  }
+  procSnapshot(iter, iter->snapshot, size);
+  mutex_unlock(&m->lock);
+
+  vma->vm_flags &= ~VM_MAYWRITE;
+  error = remap_vmalloc_range(vma, iter->snapshot, 0);
+  return error;
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Closes the procReport.
+*/
+static int releaseProcReport(struct inode *inode, struct  file *file) 
+{
+  struct seq_file* m = file->private_data;
+  ChuIter* iter = m->private;
+
+  vfree(iter->snapshot);
+  kfree(iter->childPids);
+  procCachePut(iter->cache);
+  return seq_release_private(inode, file);
+}
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	The structure that represents the procReport format.
+*/
+static const struct file_operations procReportF = 
+{
+  .owner = THIS_MODULE,
+  .open = openProcReport,
+  .read = readProcReport,
+  .write = writeProcReport,
+  .llseek = seekProcReport,
+  .release = releaseProcReport,
+};
+
+/**
+	The structure that represents the binary procReport format.
+*/
+static const struct file_operations procReportBinF = 
+{
+  .owner = THIS_MODULE,
+  .open = openProcReportBin,
+  .read = seq_read,
+  .write = writeProcReport,
+  .llseek = seq_lseek,
+  .mmap = mapProcReport,
+  .release = releaseProcReport,
+};
+
+////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+/**
+	Initializing the process report.
+*/
+static int __init initializeProcRep(void) 
+{
+  //readers write their filter, so everyone may open for writing
+  proc_create("proc_report", 0666, NULL, &procReportF);
+  proc_create("proc_report_bin", 0666, NULL, &procReportBinF);
+
+  init_irq_work(&eventWork, wakeProcEvents);
+  for_each_kernel_tracepoint(procFindTracepoint, NULL);
+  proc_create("proc_report_events", 0400, NULL, &procEventsF);
+
+  //without all three lifecycle tracepoints a shared report could miss
+  //processes, so every reader walks as if cachems were 0
+  if(forkPoint != NULL && execPoint != NULL && exitPoint != NULL &&
+     tracepoint_probe_register(forkPoint, forkGenerationProbe, NULL) == 0)
+  {
+    if(tracepoint_probe_register(execPoint, execGenerationProbe, NULL) < 0)
+    {
+      tracepoint_probe_unregister(forkPoint, forkGenerationProbe, NULL);
+      tracepoint_synchronize_unregister();
+    }
+    else if(tracepoint_probe_register(exitPoint, exitGenerationProbe, NULL) < 0)
+    {
+      tracepoint_probe_unregister(execPoint, execGenerationProbe, NULL);
+      tracepoint_probe_unregister(forkPoint, forkGenerationProbe, NULL);
+      tracepoint_synchronize_unregister();
+    }
+    else
+    {
+      generationReady = true;
+    }
+  }
+
+  //the counters follow every task from here on, the walk gives the start;
+  //they are only right with all four probes, else there is no summary
+  if(switchPoint == NULL || wakingPoint == NULL || wakeupNewPoint == NULL || freePoint == NULL ||
+     tracepoint_probe_register(switchPoint, switchProbe, NULL) < 0)
+    return 0;
+  if(tracepoint_probe_register(wakingPoint, wakingProbe, NULL) < 0)
+    goto noWaking;
+  if(tracepoint_probe_register(wakeupNewPoint, wakeupNewProbe, NULL) < 0)
+    goto noWakeupNew;
+  if(tracepoint_probe_register(freePoint, freeProbe, NULL) < 0)
+    goto noFree;
+  procSeed();
+  if(resync > 0)
+    schedule_delayed_work(&stateWork, resync * HZ);
+
+  proc_create("proc_report_summary", 0444, NULL, &procSummaryF);
+  statesReady = true;
+  return 0;
+
+noFree:
+  tracepoint_probe_unregister(wakeupNewPoint, wakeupNewProbe, NULL);
+noWakeupNew:
+  tracepoint_probe_unregister(wakingPoint, wakingProbe, NULL);
+noWaking:
+  tracepoint_probe_unregister(switchPoint, switchProbe, NULL);
+  tracepoint_synchronize_unregister();
   return 0;
 }
 
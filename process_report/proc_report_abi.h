@@ -0,0 +1,100 @@
+/*
+ *  Binary interface of the process reporter
+ *
+ *  /proc/proc_report_bin returns the same report as /proc/proc_report as
+ *  one pr_header followed by fixed-size pr_record entries, one per process
+ *  in pid order, until end of file.
+ *
+ *  The file can also be mmap()ed read-only from offset 0: the module then
+ *  builds a snapshot of the size of the mapping and header.count tells how
+ *  many records it holds.  PR_FLAG_TRUNCATED is set when the mapping was
+ *  too small for every process, map it again with a bigger size.
+ *
+ *  A filter written to the open file before reading or mapping, such as
+ *  "root=1 states=RD prefix=bash minchildren=1", limits both to the
+ *  matching processes and the header counts to them.
+ *
+ *  Version 2 records add the fields selected with "fields=children,threads,
+ *  times,rss,ctxsw" (or "fields=all") written the same way; record.fields
+ *  tells which of them were computed, the others are 0.
+ *
+ *  Readers check magic and version and step through the records by
+ *  header.record_size, so records may grow at the end in later versions.
+ *
+ *  Shared by the kernel module and the user-space reader library.
+ */
+
+#ifndef PROC_REPORT_ABI_H
+#define PROC_REPORT_ABI_H
+
+#include <linux/types.h>
+
+#define PR_MAGIC 0x54505250          // "PRPT" in little endian
+#define PR_VERSION 2
+#define PR_COMM_LEN 16
+
+#define PR_FLAG_SNAPSHOT 0x1         // the header starts an mmap() snapshot
+#define PR_FLAG_TRUNCATED 0x2        // the snapshot ran out of room
+
+#define PR_MAP_MAX (64 << 20)        // the biggest snapshot that can be mapped,
+                                     // and twice what the processes need
+
+#define PR_MAX_CHILDREN 16           // child pids a record lists at most
+
+#define PR_FIELD_CHILDREN 0x1        // child_pids
+#define PR_FIELD_THREADS 0x2         // threads
+#define PR_FIELD_TIMES 0x4           // utime_ns, stime_ns
+#define PR_FIELD_RSS 0x8             // rss_kb
+#define PR_FIELD_CTXSW 0x10          // nvcsw, nivcsw
+#define PR_FIELD_ALL 0x1f
+
+struct pr_header {
+  __u32 magic;
+  __u16 version;
+  __u16 header_size;
+  __u16 record_size;
+  __u16 flags;
+  __u32 count;                       // records that follow (snapshots only)
+  __u32 unrunnable;
+  __u32 runnable;
+  __u32 stopped;
+  __u32 reserved;
+} __attribute__((packed));
+
+struct pr_record {
+  __s32 pid;
+  __s32 ppid;
+  __s32 state;                       // task->state when the record was made
+  __u32 children;
+  __s32 first_child;                 // 0 without children
+  __u32 fields;                      // PR_FIELD_* bits of what follows comm
+  char comm[PR_COMM_LEN];            // NUL terminated
+  __u32 threads;
+  __u32 reserved;
+  __u64 utime_ns;                    // all threads, live and exited
+  __u64 stime_ns;
+  __u64 rss_kb;
+  __u64 nvcsw;                       // voluntary context switches
+  __u64 nivcsw;                      // involuntary context switches
+  __s32 child_pids[PR_MAX_CHILDREN]; // the first min(children, 16) children
+} __attribute__((packed));
+
+// /proc/proc_report_events streams these records, read in whole records
+// by one reader at a time, which needs CAP_SYS_ADMIN.  Every CPU has its
+// own ring, so the records of different CPUs are only ordered by time_ns.
+#define PR_EVENT_FORK 1              // pid was created by ppid
+#define PR_EVENT_EXEC 2              // pid runs a new program, now named comm
+#define PR_EVENT_EXIT 3              // pid exited
+#define PR_EVENT_LOST 4              // cpu dropped lost events right here
+
+struct pr_event {
+  __u16 type;
+  __u16 cpu;
+  __s32 pid;
+  __s32 ppid;
+  __u32 lost;                        // PR_EVENT_LOST only
+  __u64 time_ns;                     // ktime_get_ns() when it happened
+  char comm[PR_COMM_LEN];
+} __attribute__((packed));
+
+#endif
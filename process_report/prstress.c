@@ -0,0 +1,300 @@
+/*
+ *  Stress and benchmark harness for the process reporter
+ *
+ *  usage: prstress [-n tasks] [-f fanout] [-c churn] [-r reads] [-s scans]
+ *
+ *  Spawns a tree of tasks sleeping processes (fanout children per node)
+ *  plus churn forks and exits per second, then times reads of the whole
+ *  /proc/proc_report against a scan of /proc/<pid>/stat and
+ *  /proc/<pid>/task/<pid>/children that gets the same facts, and prints
+ *  the latency percentiles of both.  Slab memory is sampled before and
+ *  after the reads to catch leaks in the module.
+ *
+ *  Large trees need a big enough pid_max and RLIMIT_NPROC.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define REPORT_PATH "/proc/proc_report"
+
+typedef struct __pr_slab {
+  long slab_kb;                // Slab: of /proc/meminfo
+  long unreclaim_kb;           // SUnreclaim: of /proc/meminfo
+  long kmalloc_kb;             // kmalloc-* caches of /proc/slabinfo, -1 if unreadable
+} pr_slab;
+
+static char * readBuffer;
+static size_t readCapacity = 1 << 20;
+
+static double NowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Reads a whole file into readBuffer; returns the bytes read or -1
+static ssize_t ReadFile(const char * path) {
+  size_t len = 0;
+  ssize_t n;
+  char * grown;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  while ((n = read(fd, readBuffer + len, readCapacity - len)) > 0) {
+    len += n;
+    if (len == readCapacity) {
+      grown = realloc(readBuffer, readCapacity * 2);
+      if (grown == NULL) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+      }
+      readBuffer = grown;
+      readCapacity *= 2;
+    }
+  }
+  close(fd);
+  return n < 0 ? -1 : (ssize_t) len;
+}
+
+// Makes a child get SIGKILL when parent dies, so that no task outlives
+// prstress however it ends; parent may already be gone by then
+static void DieWithParent(pid_t parent) {
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  if (getppid() != parent)
+    _exit(1);
+}
+
+// Sleeps until killed, as a node of the tree with count - 1 descendants
+static void SpawnTree(int count, int fanout) {
+  int i = 0, share, left = count - 1;
+  pid_t pid, self = getpid();
+
+  while (i < fanout && left > 0) {
+    share = (left + fanout - i - 1) / (fanout - i);
+    left -= share;
+    pid = fork();
+    if (pid == 0) {
+      // the child is the node of its share
+      DieWithParent(self);
+      self = getpid();
+      left = share - 1;
+      i = 0;
+      continue;
+    }
+    if (pid < 0) {
+      fprintf(stderr, "fork failed with %d tasks left: %s\n", left + share, strerror(errno));
+      break;
+    }
+    i++;
+  }
+
+  while (1)
+    pause();
+}
+
+// Forks and reaps short-lived children at rate per second, until killed
+static void Churn(int rate) {
+  struct timespec gap = { 0, 1000000000L / rate };
+  pid_t pid;
+
+  while (1) {
+    pid = fork();
+    if (pid == 0)
+      _exit(0);
+    if (pid > 0)
+      waitpid(pid, NULL, 0);
+    nanosleep(&gap, NULL);
+  }
+}
+
+static void SampleSlab(pr_slab * slab) {
+  char line[512], name[128];
+  unsigned long active, objsize;
+  FILE * f;
+
+  slab->slab_kb = slab->unreclaim_kb = 0;
+  slab->kmalloc_kb = -1;
+
+  f = fopen("/proc/meminfo", "re");
+  if (f != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      sscanf(line, "Slab: %ld", &slab->slab_kb);
+      sscanf(line, "SUnreclaim: %ld", &slab->unreclaim_kb);
+    }
+    fclose(f);
+  }
+
+  // the caches the module allocates from; slabinfo needs root
+  f = fopen("/proc/slabinfo", "re");
+  if (f != NULL) {
+    slab->kmalloc_kb = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "%127s %lu %*u %lu", name, &active, &objsize) == 3 &&
+          strncmp(name, "kmalloc-", 8) == 0)
+        slab->kmalloc_kb += active * objsize / 1024;
+    }
+    fclose(f);
+  }
+}
+
+// Gets what the report has about every process from /proc/<pid> instead;
+// returns the number of processes
+static int ScanProc(void) {
+  char path[600];
+  struct dirent * entry;
+  DIR * dir;
+  int count = 0;
+
+  dir = opendir("/proc");
+  if (dir == NULL)
+    return -1;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+      continue;
+    snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+    if (ReadFile(path) < 0)
+      continue;
+    snprintf(path, sizeof(path), "/proc/%s/task/%s/children", entry->d_name, entry->d_name);
+    ReadFile(path);
+    count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+static int CompareDoubles(const void * a, const void * b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static void PrintLatency(const char * name, double * us, int count) {
+  if (count == 0) {
+    printf("%-10s no samples\n", name);
+    return;
+  }
+  qsort(us, count, sizeof(double), CompareDoubles);
+  printf("%-10s %8d %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, count, us[count / 2],
+         us[count * 9 / 10], us[count * 99 / 100], us[count - 1], us[0]);
+}
+
+int main(int argc, char ** argv) {
+  int tasks = 1000, fanout = 8, churn = 0, reads = 200, scans = 20;
+  int opt, i, n, baseline, churners = 0, processes = 0;
+  double * latency, start;
+  pid_t tree, self = getpid(), * churnPids = NULL;
+  pr_slab before, after;
+  ssize_t bytes = 0;
+
+  while ((opt = getopt(argc, argv, "n:f:c:r:s:")) != -1) {
+    switch (opt) {
+      case 'n': tasks = atoi(optarg); break;
+      case 'f': fanout = atoi(optarg); break;
+      case 'c': churn = atoi(optarg); break;
+      case 'r': reads = atoi(optarg); break;
+      case 's': scans = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-n tasks] [-f fanout] [-c churn/s] [-r reads] [-s scans]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if (fanout < 1)
+    fanout = 1;
+  if (reads < 1)
+    reads = 1;
+
+  readBuffer = malloc(readCapacity);
+  latency = malloc(sizeof(double) * (reads > scans ? reads : scans));
+  if (readBuffer == NULL || latency == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  // the tree gets its own process group so that one kill ends it; every
+  // node also dies with its parent, for when prstress is interrupted
+  baseline = ScanProc();
+  tree = fork();
+  if (tree == 0) {
+    DieWithParent(self);
+    setpgid(0, 0);
+    SpawnTree(tasks, fanout);
+  }
+  setpgid(tree, tree);
+
+  // one churner per 1000 forks a second, so each keeps up
+  if (churn > 0) {
+    churners = (churn + 999) / 1000;
+    churnPids = malloc(sizeof(pid_t) * churners);
+    for (i = 0; i < churners; i++) {
+      churnPids[i] = fork();
+      if (churnPids[i] == 0) {
+        DieWithParent(self);
+        Churn((churn + churners - 1) / churners);
+      }
+    }
+  }
+
+  // let the tree finish spawning before measuring
+  for (i = 0; i < 100 && (n = ScanProc()) < baseline + tasks; i++) {
+    usleep(100000);
+  }
+  printf("tasks: %d requested, %d processes visible, churn %d/s\n", tasks, n - baseline, churn);
+
+  SampleSlab(&before);
+
+  for (i = 0; i < reads; i++) {
+    start = NowUs();
+    bytes = ReadFile(REPORT_PATH);
+    latency[i] = NowUs() - start;
+    if (bytes < 0) {
+      fprintf(stderr, "cannot read %s: %s\n", REPORT_PATH, strerror(errno));
+      reads = i;
+      break;
+    }
+  }
+
+  printf("%-10s %8s %10s %10s %10s %10s %10s\n", "SOURCE", "READS", "P50(us)", "P90(us)",
+         "P99(us)", "MAX(us)", "MIN(us)");
+  PrintLatency("report", latency, reads);
+  SampleSlab(&after);
+
+  for (i = 0; i < scans; i++) {
+    start = NowUs();
+    processes = ScanProc();
+    latency[i] = NowUs() - start;
+  }
+  PrintLatency("/proc scan", latency, scans);
+
+  printf("report size: %zd bytes, /proc scan: %d processes\n", bytes, processes);
+  printf("slab: %+ld kB, unreclaimable %+ld kB", after.slab_kb - before.slab_kb,
+         after.unreclaim_kb - before.unreclaim_kb);
+  if (before.kmalloc_kb >= 0 && after.kmalloc_kb >= 0)
+    printf(", kmalloc caches %+ld kB", after.kmalloc_kb - before.kmalloc_kb);
+  printf(" over %d reads\n", reads);
+
+  kill(-tree, SIGKILL);
+  waitpid(tree, NULL, 0);
+  for (i = 0; i < churners; i++) {
+    kill(churnPids[i], SIGKILL);
+    waitpid(churnPids[i], NULL, 0);
+  }
+
+  free(churnPids);
+  free(latency);
+  free(readBuffer);
+  return 0;
+}
@@ -0,0 +1,130 @@
+
+/*
+ * Benchmarks of the screen output, run by `cargo test` under QEMU. Every
+ *  benchmark times ITERATIONS runs of one operation with the time stamp
+ *  counter and reports one line to the host over the serial port:
+ *
+ *      bench <name> iterations=<n> min=<cycles> median=<cycles> p99=<cycles> mean=<cycles>
+ *
+ *  QEMU's TSC runs at the host clock, so compare runs made on one machine.
+ */
+use core::arch::asm;
+
+use crate::{log_ring, println, serial_print, serial_println};
+use crate::vga_buffer::{ScrollMode, WRITER};
+
+const ITERATIONS: usize = 1024;
+const WARMUP: usize = 64;
+
+/*
+ * Reads the time stamp counter, after every earlier instruction finished
+ */
+#[inline(always)]
+fn rdtsc() -> u64 {
+    let (low, high): (u32, u32);
+    unsafe {
+        asm!("lfence", "rdtsc", out("eax") low, out("edx") high, options(nomem, nostack));
+    }
+    ((high as u64) << 32) | low as u64
+}
+
+/*
+ * Times an operation and reports it over the serial port
+ */
+fn bench<F: FnMut()>(name: &str, mut operation: F) {
+    let mut cycles = [0u64; ITERATIONS];
+
+    for _ in 0..WARMUP {
+        operation();
+    }
+    for sample in cycles.iter_mut() {
+        let start = rdtsc();
+        operation();
+        *sample = rdtsc() - start;
+    }
+
+    cycles.sort_unstable();
+    let mean = cycles.iter().sum::<u64>() / ITERATIONS as u64;
+    serial_println!("bench {} iterations={} min={} median={} p99={} mean={}", name, ITERATIONS,
+                    cycles[0], cycles[ITERATIONS / 2], cycles[ITERATIONS * 99 / 100], mean);
+}
+
+///////////////////////////////////////////  ////////////////////////////////////////////
+// BENCHMARKS /////////////////////////////  ////////////////////////////////////////////
+
+// What two back to back rdtsc cost, to subtract from the others
+#[test_case]
+fn rdtsc_overhead() {
+    bench("rdtsc", || {});
+}
+
+#[test_case]
+fn lock_uncontended() {
+    bench("writer_lock", || {
+        drop(WRITER.lock());
+    });
+}
+
+#[test_case]
+fn write_string_short() {
+    bench("write_string_16", || {
+        WRITER.lock().write_string("0123456789abcdef");
+    });
+}
+
+#[test_case]
+fn write_string_row() {
+    let row = "The quick brown fox jumps over the lazy dog, then the lazy dog jumps back!!!!";
+    bench("write_string_78", || {
+        WRITER.lock().write_string(row);
+    });
+}
+
+#[test_case]
+fn new_line_copy() {
+    WRITER.lock().set_scroll_mode(ScrollMode::Copy);
+    bench("new_line_copy", || {
+        WRITER.lock().write_byte(b'\n');
+    });
+    WRITER.lock().set_scroll_mode(ScrollMode::Hardware);
+}
+
+#[test_case]
+fn new_line_hardware() {
+    WRITER.lock().set_scroll_mode(ScrollMode::Hardware);
+    bench("new_line_hardware", || {
+        WRITER.lock().write_byte(b'\n');
+    });
+}
+
+#[test_case]
+fn println_formatted() {
+    bench("println", || {
+        println!("value {} of {}", 42, 1024);
+    });
+}
+
+// A print queued for the serial port, never waiting for the line
+#[test_case]
+fn serial_print_buffered() {
+    bench("serial_print", || {
+        serial_print!("\r");
+    });
+}
+
+// A print that only lands in the log ring; every 128th also drains the ring,
+//  which shows in the p99 but not in the median
+#[test_case]
+fn println_buffered() {
+    let mut printed = 0;
+    log_ring::set_auto_drain(false);
+    bench("println_buffered", || {
+        println!("value {} of {}", 42, 1024);
+        printed += 1;
+        if printed % 128 == 0 {
+            log_ring::drain();
+        }
+    });
+    log_ring::set_auto_drain(true);
+    log_ring::drain();
+}
@@ -0,0 +1,300 @@
+
+///////////////////////////////////////////  ////////////////////////////////////////////
+// STATIC VARIABLES ///////////////////////  ////////////////////////////////////////////
+
+use core::cell::UnsafeCell;
+use core::fmt;
+use core::sync::atomic::{AtomicBool, AtomicU8, AtomicUsize, Ordering};
+
+use crate::serial;
+use crate::vga_buffer::WRITER;
+
+const SLOTS: usize = 256; // records the ring holds, a power of 2
+const SLOT_BYTES: usize = 128; // two cache lines per record
+const PAYLOAD: usize = SLOT_BYTES - 2 * core::mem::size_of::<usize>(); // text bytes per record
+
+/*
+ * The ring every print!/println! appends to. Printing only copies the text
+ *  in; `drain()` renders it on the screen, right away unless auto drain is
+ *  turned off.
+ */
+pub static LOG: LogRing = LogRing::new();
+
+// Whether every print drains the ring itself
+static AUTO_DRAIN: AtomicBool = AtomicBool::new(true);
+
+// Where print!/println! go, a Route
+static ROUTE: AtomicU8 = AtomicU8::new(Route::Vga as u8);
+
+///////////////////////////////////////////  ////////////////////////////////////////////
+// ENUMS //////////////////////////////////  ////////////////////////////////////////////
+
+/*
+ * Where print!/println! go
+ *  Vga:    the screen, through this ring
+ *  Serial: the host, through the transmit buffer of COM1 (`serial.rs`)
+ *  Both:   both of them
+ */
+#[allow(dead_code)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u8)]
+pub enum Route {
+    Vga = 0,
+    Serial = 1,
+    Both = 2,
+}
+
+///////////////////////////////////////////  ////////////////////////////////////////////
+// STRUCTS ////////////////////////////////  ////////////////////////////////////////////
+
+/*
+ * One record. `sequence` tells whose turn the slot is (Dmitry Vyukov's
+ *  bounded MPMC queue):
+ *      sequence == position           a printer at `position` may fill it
+ *      sequence == position + 1       it holds the record at `position`
+ *      sequence == position + SLOTS   it was read, free for the next lap
+ */
+#[repr(C, align(128))] // a slot never shares a cache line with another
+struct Slot {
+    sequence: AtomicUsize,
+    len: UnsafeCell<usize>,
+    text: UnsafeCell<[u8; PAYLOAD]>,
+}
+
+// Keeps the two positions on their own cache lines
+#[repr(align(64))]
+struct Position(AtomicUsize);
+
+/*
+ * A multi-producer multi-consumer ring of text records that never blocks
+ *  (no locks, so it is safe from interrupts too)
+ */
+pub struct LogRing {
+    slots: [Slot; SLOTS],
+    enqueue: Position,  // the next position to fill
+    dequeue: Position,  // the next position to read
+    dropped: AtomicUsize, // records that found the ring full, since the last drain
+}
+
+// The slots are handed from one user to the next through `sequence`
+unsafe impl Sync for LogRing {}
+
+impl LogRing {
+    const fn new() -> LogRing {
+        let mut slots = [const {
+            Slot {
+                sequence: AtomicUsize::new(0),
+                len: UnsafeCell::new(0),
+                text: UnsafeCell::new([0; PAYLOAD]),
+            }
+        }; SLOTS];
+
+        let mut i = 0;
+        while i < SLOTS {
+            slots[i].sequence = AtomicUsize::new(i);
+            i += 1;
+        }
+
+        LogRing {
+            slots,
+            enqueue: Position(AtomicUsize::new(0)),
+            dequeue: Position(AtomicUsize::new(0)),
+            dropped: AtomicUsize::new(0),
+        }
+    }
+
+    /*
+     * Appends a record of at most PAYLOAD bytes; a full ring drops it and
+     *  counts it instead of waiting
+     */
+    pub fn push(&self, record: &[u8]) -> bool {
+        let len = record.len().min(PAYLOAD);
+        let mut position = self.enqueue.0.load(Ordering::Relaxed);
+
+        loop {
+            let slot = &self.slots[position % SLOTS];
+            let sequence = slot.sequence.load(Ordering::Acquire);
+            let lag = sequence.wrapping_sub(position) as isize;
+
+            if lag == 0 {
+                // our turn, if no other printer takes the position first
+                match self.enqueue.0.compare_exchange_weak(position, position + 1,
+                                                           Ordering::Relaxed, Ordering::Relaxed) {
+                    Ok(_) => {
+                        unsafe {
+                            (&mut *slot.text.get())[..len].copy_from_slice(&record[..len]);
+                            *slot.len.get() = len;
+                        }
+                        slot.sequence.store(position + 1, Ordering::Release);
+                        return true;
+                    }
+                    Err(now) => position = now,
+                }
+            } else if lag < 0 {
+                // the slot still holds the record of the last lap
+                self.dropped.fetch_add(1, Ordering::Relaxed);
+                return false;
+            } else {
+                // another printer filled it, catch up
+                position = self.enqueue.0.load(Ordering::Relaxed);
+            }
+        }
+    }
+
+    /*
+     * Takes the oldest record; returns its length, or None when there is none
+     *  ready (the oldest one may still be being written)
+     */
+    pub fn pop(&self, record: &mut [u8; PAYLOAD]) -> Option<usize> {
+        let mut position = self.dequeue.0.load(Ordering::Relaxed);
+
+        loop {
+            let slot = &self.slots[position % SLOTS];
+            let sequence = slot.sequence.load(Ordering::Acquire);
+            let lag = sequence.wrapping_sub(position + 1) as isize;
+
+            if lag == 0 {
+                match self.dequeue.0.compare_exchange_weak(position, position + 1,
+                                                           Ordering::Relaxed, Ordering::Relaxed) {
+                    Ok(_) => {
+                        let len = unsafe {
+                            let len = *slot.len.get();
+                            record[..len].copy_from_slice(&(&*slot.text.get())[..len]);
+                            len
+                        };
+                        slot.sequence.store(position + SLOTS, Ordering::Release);
+                        return Some(len);
+                    }
+                    Err(now) => position = now,
+                }
+            } else if lag < 0 {
+                return None;
+            } else {
+                position = self.dequeue.0.load(Ordering::Relaxed);
+            }
+        }
+    }
+
+    /*
+     * Tells if a record is ready to be taken
+     */
+    pub fn is_empty(&self) -> bool {
+        let position = self.dequeue.0.load(Ordering::Relaxed);
+        self.slots[position % SLOTS].sequence.load(Ordering::Acquire) != position + 1
+    }
+
+    /*
+     * Takes the count of dropped records
+     */
+    pub fn take_dropped(&self) -> usize {
+        self.dropped.swap(0, Ordering::Relaxed)
+    }
+}
+
+/*
+ * Collects formatted text on the stack and appends it to LOG a record at a
+ *  time, so a long message becomes several records
+ */
+struct RecordWriter {
+    text: [u8; PAYLOAD],
+    len: usize,
+}
+
+impl RecordWriter {
+    fn push(&mut self) {
+        if self.len != 0 {
+            LOG.push(&self.text[..self.len]);
+            self.len = 0;
+        }
+    }
+}
+
+impl fmt::Write for RecordWriter {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        let mut bytes = s.as_bytes();
+        while !bytes.is_empty() {
+            if self.len == PAYLOAD {
+                self.push();
+            }
+            let n = bytes.len().min(PAYLOAD - self.len);
+            self.text[self.len..self.len + n].copy_from_slice(&bytes[..n]);
+            self.len += n;
+            bytes = &bytes[n..];
+        }
+        Ok(())
+    }
+}
+
+///////////////////////////////////////////  ////////////////////////////////////////////
+// FUNCTIONS //////////////////////////////  ////////////////////////////////////////////
+
+/*
+ * Renders the records in LOG on the screen, and how many were dropped.
+ *  Returns at once if someone else holds WRITER (so an interrupt never waits
+ *  on the code it interrupted); the records then wait for the next drain.
+ */
+pub fn drain() {
+    let mut record = [0u8; PAYLOAD];
+
+    loop {
+        let mut writer = match WRITER.try_lock() {
+            Some(writer) => writer,
+            None => return,
+        };
+
+        while let Some(len) = LOG.pop(&mut record) {
+            writer.write_bytes(&record[..len]);
+        }
+        let dropped = LOG.take_dropped();
+        if dropped != 0 {
+            use core::fmt::Write;
+            write!(writer, "[log: {} records dropped]\n", dropped).unwrap();
+        }
+        writer.flush();
+        drop(writer);
+
+        // a printer that failed to drain while we held WRITER left its record to us
+        if LOG.is_empty() {
+            return;
+        }
+    }
+}
+
+/*
+ * Sets whether every print drains LOG itself; without it printing costs a copy
+ *  into the ring and the screen only changes on `drain()`
+ */
+#[allow(dead_code)]
+pub fn set_auto_drain(on: bool) {
+    AUTO_DRAIN.store(on, Ordering::Relaxed);
+}
+
+/*
+ * Sets where print!/println! go; serial_print!/serial_println! always go to
+ *  the host, so the screen can keep a summary of what streams there
+ */
+#[allow(dead_code)]
+pub fn set_route(route: Route) {
+    ROUTE.store(route as u8, Ordering::Relaxed);
+}
+
+#[doc(hidden)]
+pub fn _print(args: fmt::Arguments) {
+    use core::fmt::Write;
+
+    let route = ROUTE.load(Ordering::Relaxed);
+    if route != Route::Vga as u8 {
+        serial::_print(args);
+    }
+    if route == Route::Serial as u8 {
+        return;
+    }
+
+    let mut record = RecordWriter { text: [0; PAYLOAD], len: 0 };
+    record.write_fmt(args).unwrap();
+    record.push();
+
+    if AUTO_DRAIN.load(Ordering::Relaxed) {
+        drain();
+    }
+}
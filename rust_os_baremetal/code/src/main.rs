@@ -1,17 +1,93 @@
 #![no_std] // don't link the Rust standard library
 #![no_main] // disable all Rust-level entry points
+#![feature(custom_test_frameworks)] // `cargo test` can't use the built-in framework, it needs std
+#![test_runner(crate::test_runner)]
+#![reexport_test_harness_main = "test_main"] // call the tests from `_start` (there is no `main`)
 
 use core::panic::PanicInfo;
 mod vga_buffer; // Import a module `vga_buffer.rs` that handles the VGA buffer
+mod port;       // Import a module `port.rs` that reads and writes x86 I/O ports
+mod log_ring;   // Import a module `log_ring.rs` that buffers what print! writes
+mod serial;     // Import a module `serial.rs` that prints to the host over COM1
+#[cfg(test)]
+mod bench;      // Import a module `bench.rs` with the benchmarks `cargo test` runs
 
 /* 
  * This function is called when a panic happens
 */
+#[cfg(not(test))]
 #[panic_handler]
 fn panic(_info: &PanicInfo) -> ! {
     loop {}
 }
 
+/* 
+ * Under test the panic goes to the host and fails the run; the panic may
+ *  have hit while SERIAL1 was held, nothing else will release it
+*/
+#[cfg(test)]
+#[panic_handler]
+fn panic(info: &PanicInfo) -> ! {
+    unsafe {
+        serial::force_unlock();
+    }
+    serial_println!("[failed]\n");
+    serial_println!("Error: {}\n", info);
+    exit_qemu(QemuExitCode::Failed);
+    loop {}
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+
+
+/*
+ * QEMU's `isa-debug-exit` device (see `Cargo.toml`) exits QEMU with status
+ *  (value << 1) | 1 when a value is written to its port, so a success is 33
+ */
+#[allow(dead_code)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u32)]
+pub enum QemuExitCode {
+    Success = 0x10,
+    Failed = 0x11,
+}
+
+#[allow(dead_code)]
+pub fn exit_qemu(exit_code: QemuExitCode) {
+    serial::flush(); // the transmitter may still hold the last results
+    unsafe {
+        port::outl(0xf4, exit_code as u32);
+    }
+}
+
+/*
+ * Runs every `#[test_case]` and reports to the host over the serial port
+ */
+#[cfg(test)]
+pub trait Testable {
+    fn run(&self) -> ();
+}
+
+#[cfg(test)]
+impl<T: Fn()> Testable for T {
+    fn run(&self) {
+        serial_print!("{}...\t", core::any::type_name::<T>());
+        self();
+        serial_println!("[ok]");
+    }
+}
+
+#[cfg(test)]
+fn test_runner(tests: &[&dyn Testable]) {
+    serial_println!("Running {} tests", tests.len());
+    for test in tests {
+        test.run();
+    }
+    exit_qemu(QemuExitCode::Success);
+}
+
 
 ///////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////
@@ -32,6 +108,10 @@ pub extern "C" fn _start() -> ! {
     //  because it already lives in the root namespace.
     println!("Hello World{}", "!");
     println!("Next String{}", "!");
+    serial_println!("Hello Host{}", "!"); // shows up where QEMU's `-serial` points
+
+    #[cfg(test)]
+    test_main();
     
     /*
     // Test 3
@@ -55,7 +135,11 @@ pub extern "C" fn _start() -> ! {
     }
     */
 
-    loop {} // we don't want to exit the start function
+    // we don't want to exit the start function, and have nothing but the
+    //  serial port to feed until there are interrupts
+    loop {
+        serial::pump();
+    }
 }
 
 
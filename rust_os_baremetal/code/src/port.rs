@@ -0,0 +1,36 @@
+/*
+ * x86 I/O ports are a separate 16-bit address space next to memory. Devices
+ *  like the VGA controller and the serial ports are programmed through them
+ *  with the `in` and `out` instructions, which have no Rust equivalent, so
+ *  we use inline assembly.
+ */
+use core::arch::asm;
+
+/*
+ * Reads a byte from an I/O port
+ *  (unsafe because reading a device register can change the device state)
+ */
+#[inline]
+pub unsafe fn inb(port: u16) -> u8 {
+    let value: u8;
+    asm!("in al, dx", out("al") value, in("dx") port, options(nomem, nostack, preserves_flags));
+    value
+}
+
+/*
+ * Writes a byte to an I/O port
+ *  (unsafe because a wrong value can put the device in any state)
+ */
+#[inline]
+pub unsafe fn outb(port: u16, value: u8) {
+    asm!("out dx, al", in("dx") port, in("al") value, options(nomem, nostack, preserves_flags));
+}
+
+/*
+ * Writes a 32-bit value to an I/O port
+ */
+#[allow(dead_code)]
+#[inline]
+pub unsafe fn outl(port: u16, value: u32) {
+    asm!("out dx, eax", in("dx") port, in("eax") value, options(nomem, nostack, preserves_flags));
+}
@@ -0,0 +1,279 @@
+
+///////////////////////////////////////////  ////////////////////////////////////////////
+// STATIC VARIABLES ///////////////////////  ////////////////////////////////////////////
+
+use core::fmt;
+use core::sync::atomic::{AtomicUsize, Ordering};
+use spin::Mutex;
+use lazy_static::lazy_static;
+
+use crate::port;
+
+const COM1: u16 = 0x3f8; // the first serial port, QEMU's `-serial` option connects it
+
+// Registers, as offsets from the base port
+const DATA: u16 = 0;         // transmit holding register (divisor low byte while DLAB is set)
+const INTERRUPTS: u16 = 1;   // interrupt enable (divisor high byte while DLAB is set)
+const FIFO_CONTROL: u16 = 2;
+const LINE_CONTROL: u16 = 3;
+const MODEM_CONTROL: u16 = 4;
+const LINE_STATUS: u16 = 5;
+
+const LINE_DLAB: u8 = 0x80;        // the first two registers set the divisor
+const LINE_8N1: u8 = 0x03;         // 8 data bits, no parity, one stop bit
+const STATUS_THR_EMPTY: u8 = 0x20; // the transmitter (and its FIFO) is empty
+const FIFO_ENABLED: u8 = 0xc0;     // interrupt identification bits of a working FIFO
+
+const TX_FIFO: usize = 16;   // bytes a 16550 takes at once when its transmitter is empty
+const TX_BYTES: usize = 4096; // bytes buffered for the transmitter
+
+///////////////////////////////////////////  ////////////////////////////////////////////
+// STRUCTS ////////////////////////////////  ////////////////////////////////////////////
+
+/*
+ * A 16550 UART, programmed through its I/O ports. Writes go to a ring in RAM
+ *  and the transmitter gets them a FIFO at a time whenever it is empty, so no
+ *  writer waits for the line.
+ */
+pub struct SerialPort {
+    base: u16,
+    fifo: usize,         // bytes the transmitter takes at once (1 on a UART without a FIFO)
+    tx: [u8; TX_BYTES],  // bytes waiting for the transmitter
+    head: usize,         // bytes ever queued
+    tail: usize,         // bytes ever sent
+    dropped: usize,      // bytes that found tx full, not reported yet
+}
+
+impl SerialPort {
+
+    /*
+     * Sets the port up for 115200 baud, 8N1, with FIFOs and without interrupts
+     */
+    pub fn new(base: u16) -> SerialPort {
+        let fifo = unsafe {
+            port::outb(base + INTERRUPTS, 0x00);
+            port::outb(base + LINE_CONTROL, LINE_DLAB);
+            port::outb(base + DATA, 0x01); // 115200 / 1
+            port::outb(base + INTERRUPTS, 0x00);
+            port::outb(base + LINE_CONTROL, LINE_8N1);
+            port::outb(base + FIFO_CONTROL, 0xc7); // enable and clear the FIFOs
+            port::outb(base + MODEM_CONTROL, 0x0b); // DTR, RTS and OUT2
+
+            // the FIFO_CONTROL port reads back as interrupt identification,
+            //  an 8250 or 16450 has no FIFO to tell about
+            if port::inb(base + FIFO_CONTROL) & FIFO_ENABLED == FIFO_ENABLED {
+                TX_FIFO
+            } else {
+                1
+            }
+        };
+
+        SerialPort {
+            base,
+            fifo,
+            tx: [0; TX_BYTES],
+            head: 0,
+            tail: 0,
+            dropped: 0,
+        }
+    }
+
+    /*
+     * Queues bytes for the transmitter and starts sending them; what does not
+     *  fit in tx is dropped and counted instead of waited for, and reported
+     *  on the next write or pump that has room
+     */
+    pub fn write(&mut self, mut bytes: &[u8]) {
+        self.report_dropped();
+        while !bytes.is_empty() {
+            let mut room = TX_BYTES - (self.head - self.tail);
+            if room == 0 {
+                self.send();
+                room = TX_BYTES - (self.head - self.tail);
+                if room == 0 {
+                    self.dropped += bytes.len();
+                    break;
+                }
+            }
+
+            let count = bytes.len().min(room);
+            self.queue(&bytes[..count]);
+            bytes = &bytes[count..];
+        }
+        self.send();
+    }
+
+    /*
+     * Reports the dropped bytes, then fills the transmit FIFO if it is empty;
+     *  one look at the line status, never a wait
+     */
+    pub fn pump(&mut self) {
+        self.report_dropped();
+        self.send();
+    }
+
+    /*
+     * Waits until every queued byte, and the report of the dropped ones, went
+     *  to the transmitter
+     */
+    pub fn flush(&mut self) {
+        loop {
+            self.report_dropped();
+            if self.head == self.tail {
+                break;
+            }
+            self.send();
+            core::hint::spin_loop();
+        }
+    }
+
+    /*
+     * Queues "[serial: N bytes dropped]" once tx has room for it, the way
+     *  `log_ring::drain` reports its dropped records
+     */
+    fn report_dropped(&mut self) {
+        self.dropped += BUSY_DROPPED.swap(0, Ordering::Relaxed);
+        if self.dropped == 0 {
+            return;
+        }
+
+        let mut digits = [0u8; 20];
+        let mut at = digits.len();
+        let mut left = self.dropped;
+        loop {
+            at -= 1;
+            digits[at] = b'0' + (left % 10) as u8;
+            left /= 10;
+            if left == 0 {
+                break;
+            }
+        }
+
+        const BEFORE: &[u8] = b"[serial: ";
+        const AFTER: &[u8] = b" bytes dropped]\n";
+        if TX_BYTES - (self.head - self.tail) < BEFORE.len() + (digits.len() - at) + AFTER.len() {
+            return;
+        }
+        self.queue(BEFORE);
+        self.queue(&digits[at..]);
+        self.queue(AFTER);
+        self.dropped = 0;
+    }
+
+    /*
+     * Copies bytes into tx, which has room for them
+     */
+    fn queue(&mut self, bytes: &[u8]) {
+        // up to the end of tx, the rest goes to its start
+        let at = self.head % TX_BYTES;
+        let first = bytes.len().min(TX_BYTES - at);
+        self.tx[at..at + first].copy_from_slice(&bytes[..first]);
+        self.tx[..bytes.len() - first].copy_from_slice(&bytes[first..]);
+        self.head += bytes.len();
+    }
+
+    /*
+     * Fills the transmit FIFO if it is empty
+     */
+    fn send(&mut self) {
+        if self.head == self.tail {
+            return;
+        }
+        unsafe {
+            if port::inb(self.base + LINE_STATUS) & STATUS_THR_EMPTY == 0 {
+                return;
+            }
+            for _ in 0..(self.head - self.tail).min(self.fifo) {
+                port::outb(self.base + DATA, self.tx[self.tail % TX_BYTES]);
+                self.tail += 1;
+            }
+        }
+    }
+}
+
+impl fmt::Write for SerialPort {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        self.write(s.as_bytes());
+        Ok(())
+    }
+}
+
+lazy_static! {
+    pub static ref SERIAL1: Mutex<SerialPort> = Mutex::new(SerialPort::new(COM1));
+}
+
+// Bytes printed while someone else held SERIAL1, dropped instead of waited for
+static BUSY_DROPPED: AtomicUsize = AtomicUsize::new(0);
+
+// Counts the bytes of formatted text without keeping them
+struct ByteCount(usize);
+
+impl fmt::Write for ByteCount {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        self.0 += s.len();
+        Ok(())
+    }
+}
+
+/*
+ * Feeds the transmitter from wherever the kernel has time to, like its idle
+ *  loop; does nothing while someone else holds SERIAL1
+ */
+pub fn pump() {
+    if let Some(mut serial) = SERIAL1.try_lock() {
+        serial.pump();
+    }
+}
+
+/*
+ * Sends everything queued, before QEMU exits or the kernel stops; does
+ *  nothing while someone else holds SERIAL1, so an exit never hangs on it
+ */
+pub fn flush() {
+    if let Some(mut serial) = SERIAL1.try_lock() {
+        serial.flush();
+    }
+}
+
+/*
+ * Frees SERIAL1 for a panic handler, whatever held it will never run again
+ *  (unsafe because that holder may have been midway through a write)
+ */
+#[allow(dead_code)]
+pub unsafe fn force_unlock() {
+    SERIAL1.force_unlock();
+}
+
+/////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+/*
+ * Queues the text for the host. Never spins on SERIAL1: if an interrupted
+ *  writer holds it, the text is dropped and counted like a full tx
+ */
+#[doc(hidden)]
+pub fn _print(args: fmt::Arguments) {
+    use core::fmt::Write;
+
+    match SERIAL1.try_lock() {
+        Some(mut serial) => serial.write_fmt(args).unwrap(),
+        None => {
+            let mut count = ByteCount(0);
+            count.write_fmt(args).unwrap();
+            BUSY_DROPPED.fetch_add(count.0, Ordering::Relaxed);
+        }
+    }
+}
+
+// Prints to the host through the serial port, like `print!`
+#[macro_export]
+macro_rules! serial_print {
+    ($($arg:tt)*) => ($crate::serial::_print(format_args!($($arg)*)));
+}
+
+// Prints to the host through the serial port, like `println!`
+#[macro_export]
+macro_rules! serial_println {
+    () => ($crate::serial_print!("\n"));
+    ($($arg:tt)*) => ($crate::serial_print!("{}\n", format_args!($($arg)*)));
+}
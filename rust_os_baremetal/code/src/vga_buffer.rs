@@ -4,6 +4,17 @@
 const BUFFER_HEIGHT: usize = 25;
 const BUFFER_WIDTH: usize = 80;
 
+// The text mode VRAM at 0xb8000 is 32 KiB, room for 204 rows of 80 characters.
+//  The screen shows the 25 rows from the CRTC start address on.
+const VRAM_ROWS: usize = 0x8000 / (BUFFER_WIDTH * 2);
+
+// The CRTC (CRT controller) registers are reached through an index port
+//  (which register) and a data port (its new value)
+const CRTC_INDEX: u16 = 0x3d4;
+const CRTC_DATA: u16 = 0x3d5;
+const CRTC_START_HIGH: u8 = 0x0c; // start address bits 15..8, in characters
+const CRTC_START_LOW: u8 = 0x0d;  // start address bits 7..0
+
 ///////////////////////////////////////////  ////////////////////////////////////////////
 // ENUMS //////////////////////////////////  ////////////////////////////////////////////
 
@@ -29,6 +40,20 @@ pub enum Color {
     White = 15,
 }
 
+/*
+ * How the screen scrolls up on a new line
+ *  Copy:     every row is copied one row up, the bottom row is cleared
+ *  Hardware: VRAM is a ring of rows; the CRTC start address moves down one
+ *            row and only the new bottom row is cleared. The visible rows are
+ *            copied back to the top of VRAM once the bottom of VRAM is reached
+ */
+#[allow(dead_code)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ScrollMode {
+    Copy,
+    Hardware,
+}
+
 ///////////////////////////////////////////  ////////////////////////////////////////////
 // STRUCTS ////////////////////////////////  ////////////////////////////////////////////
 
@@ -50,10 +75,56 @@ struct ScreenChar {
 }
 
 use volatile::Volatile;
+use crate::port;
 
+// All of VRAM, the screen is BUFFER_HEIGHT rows of it
 #[repr(transparent)] // Makes sure this struct has the exact same data layout as a u8
 struct Buffer {
-    chars: [[Volatile<ScreenChar>; BUFFER_WIDTH]; BUFFER_HEIGHT],
+    chars: [[Volatile<ScreenChar>; BUFFER_WIDTH]; VRAM_ROWS],
+}
+
+// A row of the screen kept in RAM. Aligned to 8 bytes (like every VRAM row,
+//  they are 160 bytes long) so that it can be copied 4 characters at a time
+#[derive(Clone, Copy)]
+#[repr(C, align(8))]
+struct ShadowRow {
+    chars: [ScreenChar; BUFFER_WIDTH],
+}
+
+/*
+ * A RAM copy of what the screen should show. Writes go here and are flushed
+ *  to VRAM in bulk; VRAM is never read back.
+ */
+struct Shadow {
+    rows: [ShadowRow; BUFFER_HEIGHT],
+    dirty: [(usize, usize); BUFFER_HEIGHT], // columns start..end of every row that VRAM lacks
+    pending: usize,                         // characters written since the last flush
+}
+
+// A row without dirty columns
+const CLEAN: (usize, usize) = (BUFFER_WIDTH, 0);
+
+impl Shadow {
+    fn new() -> Shadow {
+        // light gray on black is what the BIOS clears the screen with
+        let blank = ScreenChar {
+            ascii_character: b' ',
+            color_code: ColorCode::new(Color::LightGray, Color::Black),
+        };
+        Shadow {
+            rows: [ShadowRow { chars: [blank; BUFFER_WIDTH] }; BUFFER_HEIGHT],
+            dirty: [CLEAN; BUFFER_HEIGHT],
+            pending: 0,
+        }
+    }
+
+    // Notes that columns start..end of a row changed
+    fn mark(&mut self, row: usize, start: usize, end: usize) {
+        let dirty = &mut self.dirty[row];
+        dirty.0 = dirty.0.min(start);
+        dirty.1 = dirty.1.max(end);
+        self.pending += end - start;
+    }
 }
 
 /*
@@ -64,6 +135,10 @@ pub struct Writer {
     column_position: usize, // keeps tract of the current position in the last row
     color_code: ColorCode,  // current foreground and background colors
     buffer: &'static mut Buffer, // reference to the VGA buffer. the `'static` is for lifetime of a 
+    scroll_mode: ScrollMode, // how new lines scroll the screen
+    top_row: usize,          // the VRAM row shown at the top of the screen (0 when copying)
+    shadow: Shadow,          // the screen in RAM, flushed to `buffer`
+    flush_threshold: usize,  // flush once this many characters are pending
 }
 
 impl Writer {
@@ -85,46 +160,253 @@ impl Writer {
                 let col = self.column_position;
 
                 let color_code = self.color_code;
-                self.buffer.chars[row][col].write(ScreenChar {
+                self.shadow.rows[row].chars[col] = ScreenChar {
                         ascii_character: byte,
                         color_code,
-                    });
+                    };
+                self.shadow.mark(row, col, col + 1);
                 self.column_position += 1;
+
+                if self.shadow.pending >= self.flush_threshold {
+                    self.flush();
+                }
             }
         }
     }
 
+    /*
+     * Copies the dirty part of every row to VRAM, as u64 stores of 4 characters
+     */
+    pub fn flush(&mut self) {
+        for row in 0..BUFFER_HEIGHT {
+            let (start, end) = self.shadow.dirty[row];
+            if start >= end {
+                continue;
+            }
+
+            // the shadow holds the whole row, so the range can grow to whole u64s
+            let from = self.shadow.rows[row].chars.as_ptr() as *const u64;
+            let to = self.buffer.chars[self.top_row + row].as_mut_ptr() as *mut u64;
+            for i in start / 4..(end + 3) / 4 {
+                unsafe { core::ptr::write_volatile(to.add(i), *from.add(i)) };
+            }
+            self.shadow.dirty[row] = CLEAN;
+        }
+        self.shadow.pending = 0;
+    }
+
+    /*
+     * Sets how many written characters may wait for a flush (1 flushes every one)
+     */
+    #[allow(dead_code)]
+    pub fn set_flush_threshold(&mut self, characters: usize) {
+        self.flush_threshold = characters.max(1);
+    }
+
 }
 
 impl Writer {
     fn new_line(&mut self) {
-        for row in 1..BUFFER_HEIGHT {
-            for col in 0..BUFFER_WIDTH {
-                let character = self.buffer.chars[row][col].read();
-                self.buffer.chars[row - 1][col].write(character);
-            }
-        }
+        // the screen moves up in the shadow, and so do the parts VRAM lacks
+        self.shadow.rows.copy_within(1.., 0);
+        self.shadow.dirty.copy_within(1.., 0);
+        self.shadow.dirty[BUFFER_HEIGHT - 1] = CLEAN;
         self.clear_row(BUFFER_HEIGHT - 1);
         self.column_position = 0;
+
+        match self.scroll_mode {
+            ScrollMode::Copy => {
+                self.mark_all();
+                self.flush();
+            }
+            ScrollMode::Hardware => {
+                if self.top_row + BUFFER_HEIGHT < VRAM_ROWS {
+                    self.top_row += 1;
+                } else {
+                    // out of VRAM: the screen goes back to the top from the shadow,
+                    //  once every VRAM_ROWS - BUFFER_HEIGHT lines
+                    self.top_row = 0;
+                    self.mark_all();
+                }
+                // the new bottom row holds whatever was there VRAM_ROWS lines ago
+                self.flush();
+                self.set_start_row(self.top_row);
+            }
+        }
     }
 
-    fn clear_row(&mut self, row: usize) {/* TODO */}
+    /*
+     * Fills a row of the screen with blanks
+     */
+    fn clear_row(&mut self, row: usize) {
+        let blank = ScreenChar {
+            ascii_character: b' ',
+            color_code: self.color_code,
+        };
+        self.shadow.rows[row].chars = [blank; BUFFER_WIDTH];
+        self.shadow.mark(row, 0, BUFFER_WIDTH);
+    }
+
+    /*
+     * Marks every row of the screen for the next flush
+     */
+    fn mark_all(&mut self) {
+        for row in 0..BUFFER_HEIGHT {
+            self.shadow.mark(row, 0, BUFFER_WIDTH);
+        }
+    }
+
+    /*
+     * Makes the screen start at a row of VRAM, through the CRTC start address
+     */
+    fn set_start_row(&self, row: usize) {
+        let start = (row * BUFFER_WIDTH) as u16;
+        unsafe {
+            port::outb(CRTC_INDEX, CRTC_START_HIGH);
+            port::outb(CRTC_DATA, (start >> 8) as u8);
+            port::outb(CRTC_INDEX, CRTC_START_LOW);
+            port::outb(CRTC_DATA, start as u8);
+        }
+    }
+
+    /*
+     * Switches how new lines scroll; the screen looks the same afterwards
+     */
+    #[allow(dead_code)]
+    pub fn set_scroll_mode(&mut self, mode: ScrollMode) {
+        // copying needs the screen at the top of VRAM
+        if mode == ScrollMode::Copy && self.top_row != 0 {
+            self.top_row = 0;
+            self.mark_all();
+            self.flush();
+            self.set_start_row(0);
+        }
+        self.scroll_mode = mode;
+    }
 }
 
 impl Writer {
     pub fn write_string(&mut self, s: &str) {
-        for byte in s.bytes() {
-            match byte {
-                // printable ASCII byte or newline
-                0x20..=0x7e | b'\n' => self.write_byte(byte),
+        self.write_bytes(s.as_bytes());
+    }
+
+    /*
+     * Writes text that may not be whole UTF-8 (like a record of the log ring);
+     *  every byte outside printable ASCII shows as a ■
+     */
+    pub fn write_bytes(&mut self, bytes: &[u8]) {
+        let mut i = 0;
+
+        while i < bytes.len() {
+            match bytes[i] {
+                // printable ASCII: the run of it that fits on the row goes in at once
+                0x20..=0x7e => {
+                    if self.column_position >= BUFFER_WIDTH {
+                        self.new_line();
+                    }
+                    let len = printable_len(&bytes[i..], BUFFER_WIDTH - self.column_position);
+                    self.write_run(&bytes[i..i + len]);
+                    i += len;
+                }
+                b'\n' => {
+                    self.write_byte(b'\n');
+                    i += 1;
+                }
                 // not part of printable ASCII range
-                _ => self.write_byte(0xfe),
+                _ => {
+                    self.write_byte(0xfe);
+                    i += 1;
+                }
+            }
+        }
+    }
+
+    /*
+     * Writes printable ASCII that fits on the bottom row, 4 characters per u64
+     *  store into the shadow
+     */
+    fn write_run(&mut self, run: &[u8]) {
+        let row = BUFFER_HEIGHT - 1;
+        let col = self.column_position;
+        let color = ((self.color_code.0 as u64) << 8) * 0x0001_0001_0001_0001;
+        let to = unsafe { self.shadow.rows[row].chars.as_mut_ptr().add(col) } as *mut u64;
+
+        // 8 characters at a time, then 4, then one by one
+        let mut i = 0;
+        while i + 8 <= run.len() {
+            let word = u64::from_le_bytes(run[i..i + 8].try_into().unwrap());
+            unsafe {
+                to.add(i / 4).write_unaligned(widen(word as u32) | color);
+                to.add(i / 4 + 1).write_unaligned(widen((word >> 32) as u32) | color);
             }
+            i += 8;
+        }
+        if i + 4 <= run.len() {
+            let word = u32::from_le_bytes(run[i..i + 4].try_into().unwrap());
+            unsafe { to.add(i / 4).write_unaligned(widen(word) | color) };
+            i += 4;
+        }
+        for (offset, &byte) in run[i..].iter().enumerate() {
+            self.shadow.rows[row].chars[col + i + offset] = ScreenChar {
+                ascii_character: byte,
+                color_code: self.color_code,
+            };
+        }
 
+        self.shadow.mark(row, col, col + run.len());
+        self.column_position += run.len();
+        if self.shadow.pending >= self.flush_threshold {
+            self.flush();
         }
     }
 }
 
+/*
+ * SWAR ("SIMD within a register") helpers: the kernel is built without SSE,
+ *  so 8 bytes are handled at once in a plain u64 instead
+ */
+const ONES: u64 = 0x0101_0101_0101_0101;
+const HIGHS: u64 = 0x8080_8080_8080_8080;
+
+/*
+ * Tells if all 8 bytes of a word are printable ASCII (0x20..=0x7e)
+ */
+fn all_printable(word: u64) -> bool {
+    // a byte below 0x20 borrows into its top bit, one above 0x7e carries into
+    //  it (or had it set already); either can only spill into the bytes above
+    //  a byte that already failed
+    let below = word.wrapping_sub(ONES * 0x20) & !word;
+    let above = word.wrapping_add(ONES * (0x7f - 0x7e)) | word;
+    (below | above) & HIGHS == 0
+}
+
+/*
+ * Counts the printable ASCII bytes at the start of bytes, up to max
+ */
+fn printable_len(bytes: &[u8], max: usize) -> usize {
+    let limit = bytes.len().min(max);
+    let mut len = 0;
+    while len + 8 <= limit
+        && all_printable(u64::from_le_bytes(bytes[len..len + 8].try_into().unwrap()))
+    {
+        len += 8;
+    }
+    while len < limit && (0x20..=0x7e).contains(&bytes[len]) {
+        len += 1;
+    }
+    len
+}
+
+/*
+ * Spreads 4 bytes to the low bytes of 4 u16 lanes, the ascii_character half of
+ *  4 ScreenChars (x86 is little endian)
+ */
+fn widen(four: u32) -> u64 {
+    let mut word = four as u64;
+    word = (word | (word << 16)) & 0x0000_ffff_0000_ffff;
+    (word | (word << 8)) & 0x00ff_00ff_00ff_00ff
+}
+
 
 use spin::Mutex;
 use lazy_static::lazy_static;
@@ -156,6 +438,10 @@ lazy_static! {
             buffer: unsafe { &mut *(0xb8000 as *mut Buffer) }, // static mut is HIGHLY DISCOURAGED!!!
             // 0xb8000 : A memory location that is traditionally used for the text 
             //           buffer on computers with BIOS-based hardware.
+            scroll_mode: ScrollMode::Hardware, // a new line is a row clear and a few port writes
+            top_row: 0,
+            shadow: Shadow::new(),
+            flush_threshold: BUFFER_WIDTH, // at least once a row
         }
     );
 }
@@ -181,25 +467,20 @@ impl fmt::Write for Writer {
 macro_rules! println {    // println macro has 2 rulses ...
 
     // Rule 1: Handle no paramters
-    () => (print!("\n"));
+    () => ($crate::print!("\n"));
 
     /* Rule 2: Handle parameters
      * `$` specify a variable that will be passed to the macro as an argument
      * `tt` is a placeholder that is used in macro definitions to match any token tree
      */
-    ($($arg:tt)*) => (print!("{}\n", format_args!($($arg)*))); 
-    // We do `print!` in this macro so we don't have to import print when importing println
+    ($($arg:tt)*) => ($crate::print!("{}\n", format_args!($($arg)*))); 
+    // We do `$crate::print!` in this macro so we don't have to import print when importing println
 }
 
 #[macro_export]
 macro_rules! print {
-    ($($arg:tt)*) => ($crate::vga_buffer::_print(format_args!($($arg)*)));
-}
-
-#[doc(hidden)]
-pub fn _print(args: fmt::Arguments) {
-    use core::fmt::Write;
-    WRITER.lock().write_fmt(args).unwrap();
+    // Goes through the log ring (`log_ring.rs`), which renders it here
+    ($($arg:tt)*) => ($crate::log_ring::_print(format_args!($($arg)*)));
 }
 /////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
@@ -215,10 +496,15 @@ pub fn print_something() {
         column_position: 0,
         color_code: ColorCode::new(Color::Yellow, Color::Black),
         buffer: unsafe { &mut *(0xb8000 as *mut Buffer) },
+        scroll_mode: ScrollMode::Copy,
+        top_row: 0,
+        shadow: Shadow::new(),
+        flush_threshold: BUFFER_WIDTH,
     };
 
     writer.write_byte(b'H');
     writer.write_string("ello! ");
     write!(writer, "The numbers are {} and {}", 42, 1.0/3.0).unwrap();
+    writer.flush();
 }
 